@@ -0,0 +1,55 @@
+/*
+ * xdbedizzy - CPU affinity of the render threads (-pin)
+ *
+ * With -pin every window thread is bound to one CPU, the windows going
+ * round robin over the CPUs the process may run on, so that the threads
+ * of a capacity test do not migrate between cores and the results of
+ * one run are comparable with the next.  Where the threads outnumber
+ * the CPUs several share one.  Without pthread_setaffinity_np() -pin
+ * does nothing.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* cpu_set_t and pthread_setaffinity_np() are GNU extensions */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include "xdbedizzy.h"
+
+/* Bind the calling thread to the |n|th CPU it may run on, modulo their
+ * number; returns the CPU or -1 if it could not be bound */
+int pin_thread(int n)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t allowed, one;
+    int       count, cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return (-1);
+    count = CPU_COUNT(&allowed);
+    if (count == 0)
+        return (-1);
+    n %= count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+            break;
+    }
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(one), &one) != 0)
+        return (-1);
+    return (cpu);
+#else
+    (void) n;
+    return (-1);
+#endif
+}
@@ -0,0 +1,96 @@
+/*
+ * xdbedizzy - CPU benchmark of the frame pipeline (-cpubench)
+ *
+ * Runs everything a frame costs on the client up to the point where
+ * Xlib would be called: the compiled rings are translated and culled,
+ * the spokes rotated, merged and emitted, all into a DrawList that
+ * serves as a null sink.  This is timed over a matrix of spoke counts
+ * and window sizes, without any X display, so CPU regressions show up
+ * on build machines.  The costs of the server are left to -benchmark.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "xdbedizzy.h"
+
+static const int bench_spokes[] = { 12, 120, 1200, 12000, 120000 };
+static const int bench_sizes[]  = { 200, 400, 1000, 2000 };
+
+#define NUM_ITEMS(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static
+unsigned long count_primitives(const DrawList *dl)
+{
+    unsigned long n = 0;
+    int           i;
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+
+        n += b->narcs + b->nsegs;
+    }
+    return (n);
+}
+
+/* Time |frames| frames of |s| in a |size| x |size| window */
+static
+void bench_one(FILE *fp, const Scene *s, int spokes, int size, int frames,
+               Bool cull)
+{
+    SceneLists    sl;
+    DrawList      dl;
+    unsigned long prims = 0;
+    int64_t       t0, t1;
+    int           n;
+
+    scene_lists_init(&sl, s, cull);
+    memset(&dl, 0, sizeof(dl));
+    dl.line_width = s->line_width;
+
+    /* One untimed frame to allocate the tables and arrays */
+    scene_build_frame(&dl, &sl, NULL, 0., size, size, True, cull);
+
+    t0 = dizzy_now_ns();
+    for (n = 0; n < frames; n++) {
+        scene_build_frame(&dl, &sl, NULL, n * 0.05, size, size, True, cull);
+        prims += count_primitives(&dl);
+    }
+    t1 = dizzy_now_ns();
+
+    fprintf(fp, "%s: cpubench %7d spokes %4dx%-4d %10.0f ns/frame "
+            "%8lu prims/frame %8.2f Mprims/s\n",
+            ProgramName, spokes, size, size,
+            (double)(t1 - t0) / frames, prims / frames,
+            (t1 > t0) ? prims / ((t1 - t0) / 1e9) / 1e6 : 0.);
+
+    draw_list_free(&dl);
+    scene_lists_free(&sl);
+}
+
+/*
+ * Time |frames| frames for every spoke count and window size of the
+ * matrix, with the scene of |scene_file| (NULL for the built-in one),
+ * all rings drawn and |cull| as with -nocull.  Returns False if the
+ * scene cannot be loaded.
+ */
+Bool frame_bench(FILE *fp, const char *scene_file, int frames, Bool cull)
+{
+    Scene s;
+    int   i, j;
+
+    for (i = 0; i < NUM_ITEMS(bench_spokes); i++) {
+        if (scene_file == NULL)
+            scene_default(&s, bench_spokes[i]);
+        else if (!scene_load(&s, scene_file, bench_spokes[i]))
+            return (False);
+        for (j = 0; j < NUM_ITEMS(bench_sizes); j++)
+            bench_one(fp, &s, bench_spokes[i], bench_sizes[j], frames, cull);
+        scene_free(&s);
+    }
+    return (True);
+}
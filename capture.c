@@ -0,0 +1,537 @@
+/*
+ * xdbedizzy - frame capture (-capture)
+ *
+ * Reads back every frame of -benchmark from the window once the server
+ * has finished it, stores it in a file and hashes it, so the output of
+ * two servers can be compared: a server that is fast because it draws
+ * garbage shows up as a different hash.  With -capture the rotation of
+ * frame n is exactly n times -delta, whatever the frame rate, so two
+ * runs render the same sequence of frames.
+ *
+ * The file is created at its final size before the first frame and
+ * mapped into memory.  It starts with a text header of CAPTURE_HEADER
+ * bytes, padded with NULs, followed by the frames without any padding
+ * between them, i.e. raw video in the pixel format of the visual:
+ *
+ *     xdbedizzy capture 1
+ *     width 400
+ *     height 400
+ *     stride 1600
+ *     bits_per_pixel 32
+ *     byte_order lsbfirst
+ *     red_mask 0xff0000
+ *     green_mask 0xff00
+ *     blue_mask 0xff
+ *     frames 1000
+ *     delta 0.05
+ *
+ * There is no Y4M output: Y4M only carries YUV, and converting every
+ * frame would be the copy this is designed to avoid, besides changing
+ * the pixels that are hashed.
+ *
+ * The frames are read in the cheapest way the connection allows:
+ *
+ *  - With libX11-xcb and xcb-shm, and MIT-SHM 1.2 on a local server,
+ *    the file itself is attached to the server with ShmAttachFd and
+ *    ShmGetImage writes each frame straight into its place in the
+ *    mapping; the client does not touch the pixels except to hash them.
+ *  - Otherwise XShmGetImage() reads into a shared memory segment, which
+ *    is copied into the mapping.
+ *  - Without MIT-SHM, e.g. on a remote display, XGetSubImage() stores
+ *    the reply in the mapping.
+ *
+ * The hash only covers the bits of the red, green and blue masks, as
+ * the unused bits of a 32 bpp pixel differ between servers.  The hash of
+ * every frame is written to <file>.sums, one "frame hash" line each.
+ * The time spent reading back and hashing is measured apart from the
+ * frame times of -benchmark and reported on its own.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#include "xdbedizzy.h"
+
+#ifdef HAVE_XCB_SHM
+#include <sys/socket.h>
+#include <X11/Xlib-xcb.h>
+#include <xcb/shm.h>
+#endif
+
+#define CAPTURE_HEADER 4096    /* a page, so the frames can be mapped */
+
+enum {
+    CAPTURE_ATTACH_FD,  /* ShmGetImage into the file itself */
+    CAPTURE_SHM,        /* XShmGetImage, then a copy */
+    CAPTURE_GET_IMAGE   /* XGetSubImage into the mapping */
+};
+
+static const char *method_names[] = {
+    "ShmAttachFd, no copy", "XShmGetImage and one copy", "XGetImage"
+};
+
+static Display         *cap_dpy;
+static Window           cap_win;
+static const char      *cap_path;
+static int              cap_fd = -1;
+static unsigned char   *cap_map;
+static size_t           cap_size;
+static int              cap_width, cap_height;
+static size_t           cap_stride, cap_frame_size;
+static uint32_t         cap_mask;
+static int              cap_frames, cap_count;
+static int              cap_method;
+static Bool             cap_stopped;
+static Visual          *cap_visual;
+static double           cap_delta;
+static uint64_t        *cap_hashes;
+static int64_t          cap_time, cap_max;
+static XImage          *cap_image;
+static XShmSegmentInfo  cap_shminfo;
+static Bool             attach_failed;
+#ifdef HAVE_XCB_SHM
+static uint32_t         cap_seg;
+#endif
+
+/*
+ * A 64 bit hash of the |width| x |height| pixels at |p|, rows |stride|
+ * bytes apart, of which only the bits in |mask| count.  Four lanes of
+ * multiply and rotate rounds, so the multiplications overlap; fast
+ * enough to keep up with reading the frames back.
+ */
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+#define ROUND(acc, v) ((acc) = ROTL((acc) + (v) * PRIME2, 31) * PRIME1)
+
+static
+uint64_t hash_frame(const unsigned char *p, size_t stride, int width,
+                    int height, uint32_t mask)
+{
+    uint64_t acc[4] = { PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1 };
+    uint64_t m = mask | (uint64_t) mask << 32;
+    uint64_t h, v;
+    int      x, y, lane = 0;
+
+    for (y = 0; y < height; y++, p += stride) {
+        const uint32_t *row = (const uint32_t *) p;
+
+        for (x = 0; x + 8 <= width; x += 8) {
+            uint64_t v0, v1, v2, v3;
+
+            memcpy(&v0, row + x,     8);
+            memcpy(&v1, row + x + 2, 8);
+            memcpy(&v2, row + x + 4, 8);
+            memcpy(&v3, row + x + 6, 8);
+            ROUND(acc[0], v0 & m);
+            ROUND(acc[1], v1 & m);
+            ROUND(acc[2], v2 & m);
+            ROUND(acc[3], v3 & m);
+        }
+        for (; x < width; x++) {
+            ROUND(acc[lane], (uint64_t) (row[x] & mask));
+            lane = (lane + 1) & 3;
+        }
+    }
+
+    h = ROTL(acc[0], 1) + ROTL(acc[1], 7) + ROTL(acc[2], 12) + ROTL(acc[3], 18);
+    v = (uint64_t) width << 32 | (uint32_t) height;
+    h = (h ^ v) * PRIME1;
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return (h);
+}
+
+static
+int shm_error_handler(Display *dpy, XErrorEvent *ev)
+{
+    (void) dpy;
+    (void) ev;
+    attach_failed = True;
+    return (0);
+}
+
+#ifdef HAVE_XCB_SHM
+/* Attach the capture file to the server; needs MIT-SHM 1.2 and a local
+ * connection to pass the file descriptor over */
+static
+Bool attach_file(void)
+{
+    xcb_connection_t              *c = XGetXCBConnection(cap_dpy);
+    xcb_shm_query_version_reply_t *version;
+    xcb_generic_error_t           *err;
+    struct sockaddr                addr;
+    socklen_t                      len = sizeof(addr);
+    Bool                           ok;
+    int                            fd;
+
+    /* Over TCP passing the descriptor would break the connection, and
+     * the offsets of ShmGetImage only have 32 bits */
+    if (getsockname(ConnectionNumber(cap_dpy), &addr, &len) != 0 ||
+        addr.sa_family != AF_UNIX || cap_size > UINT32_MAX)
+        return (False);
+
+    version = xcb_shm_query_version_reply(c, xcb_shm_query_version(c), NULL);
+    ok = (version != NULL &&
+          (version->major_version > 1 ||
+           (version->major_version == 1 && version->minor_version >= 2)));
+    free(version);
+    if (!ok)
+        return (False);
+
+    /* xcb closes the descriptor once it is sent */
+    fd = dup(cap_fd);
+    if (fd < 0)
+        return (False);
+    XFlush(cap_dpy);
+    cap_seg = xcb_generate_id(c);
+    err = xcb_request_check(c, xcb_shm_attach_fd_checked(c, cap_seg, fd, 0));
+    if (err != NULL) {
+        free(err);
+        return (False);
+    }
+    return (True);
+}
+
+static
+Bool get_image_fd(unsigned char *dst)
+{
+    xcb_connection_t          *c = XGetXCBConnection(cap_dpy);
+    xcb_shm_get_image_reply_t *r;
+
+    r = xcb_shm_get_image_reply(c,
+            xcb_shm_get_image(c, cap_win, 0, 0, cap_width, cap_height,
+                              ~0U, XCB_IMAGE_FORMAT_Z_PIXMAP, cap_seg,
+                              (uint32_t) (dst - cap_map)), NULL);
+    free(r);
+    return (r != NULL);
+}
+#endif
+
+/* A shared memory XImage for XShmGetImage(), like raster.c uses */
+static
+Bool create_shm_image(Visual *visual, int depth)
+{
+    int (*old_handler)(Display *, XErrorEvent *);
+
+    cap_image = XShmCreateImage(cap_dpy, visual, depth, ZPixmap, NULL,
+                                &cap_shminfo, cap_width, cap_height);
+    if (cap_image == NULL)
+        return (False);
+    cap_shminfo.shmid = shmget(IPC_PRIVATE,
+                               cap_image->bytes_per_line * cap_image->height,
+                               IPC_CREAT | 0600);
+    if (cap_shminfo.shmid < 0) {
+        XDestroyImage(cap_image);
+        cap_image = NULL;
+        return (False);
+    }
+    cap_shminfo.shmaddr  = cap_image->data = shmat(cap_shminfo.shmid, NULL, 0);
+    cap_shminfo.readOnly = False;
+    if (cap_shminfo.shmaddr == (char *)-1) {
+        shmctl(cap_shminfo.shmid, IPC_RMID, NULL);
+        cap_image->data = NULL;
+        XDestroyImage(cap_image);
+        cap_image = NULL;
+        return (False);
+    }
+
+    /* Only the error of the attach may go to shm_error_handler() */
+    XSync(cap_dpy, False);
+    attach_failed = False;
+    old_handler = XSetErrorHandler(shm_error_handler);
+    XShmAttach(cap_dpy, &cap_shminfo);
+    XSync(cap_dpy, False);
+    XSetErrorHandler(old_handler);
+    shmctl(cap_shminfo.shmid, IPC_RMID, NULL);
+
+    if (attach_failed) {
+        cap_image->data = NULL;
+        XDestroyImage(cap_image);
+        cap_image = NULL;
+        shmdt(cap_shminfo.shmaddr);
+        return (False);
+    }
+    return (True);
+}
+
+/* The header, written last so that it has the number of frames that
+ * were actually captured */
+static
+void write_header(void)
+{
+    memset(cap_map, 0, CAPTURE_HEADER);
+    snprintf((char *) cap_map, CAPTURE_HEADER,
+             "xdbedizzy capture 1\n"
+             "width %d\nheight %d\nstride %lu\nbits_per_pixel 32\n"
+             "byte_order %s\n"
+             "red_mask %#lx\ngreen_mask %#lx\nblue_mask %#lx\n"
+             "frames %d\ndelta %g\n",
+             cap_width, cap_height, (unsigned long) cap_stride,
+             ImageByteOrder(cap_dpy) == LSBFirst ? "lsbfirst" : "msbfirst",
+             cap_visual->red_mask, cap_visual->green_mask,
+             cap_visual->blue_mask, cap_count, cap_delta);
+}
+
+/* Create the file of |cap_size| bytes and map it */
+static
+Bool map_file(void)
+{
+    int err;
+
+    cap_fd = open(cap_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (cap_fd < 0) {
+        fprintf(stderr, "%s: Cannot create %s: %s\n", ProgramName, cap_path,
+                strerror(errno));
+        return (False);
+    }
+    /* Allocate the blocks now rather than while frames are captured;
+     * not every file system can */
+    err = posix_fallocate(cap_fd, 0, (off_t) cap_size);
+    if (err != 0 && ftruncate(cap_fd, (off_t) cap_size) != 0)
+        err = errno;
+    else
+        err = 0;
+    if (err == 0) {
+        cap_map = mmap(NULL, cap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       cap_fd, 0);
+        if (cap_map == MAP_FAILED) {
+            cap_map = NULL;
+            err = errno;
+        }
+    }
+    if (err != 0) {
+        fprintf(stderr, "%s: Cannot allocate %lu bytes for %s: %s\n",
+                ProgramName, (unsigned long) cap_size, cap_path, strerror(err));
+        close(cap_fd);
+        cap_fd = -1;
+        unlink(cap_path);
+        return (False);
+    }
+    return (True);
+}
+
+/*
+ * Prepare to capture |frames| frames of |win| on |dpy| into |path|.
+ * Only 32 bits per pixel visuals are supported.  Returns False with a
+ * message on stderr if the file cannot be created.
+ */
+Bool capture_open(Display *dpy, Window win, const char *path, int frames,
+                  double delta)
+{
+    XWindowAttributes    attrs;
+    XPixmapFormatValues *formats;
+    int                  i, n, bpp = 0;
+    int                  major, minor;
+    Bool                 pixmaps;
+
+    XGetWindowAttributes(dpy, win, &attrs);
+    formats = XListPixmapFormats(dpy, &n);
+    for (i = 0; i < n; i++) {
+        if (formats[i].depth == attrs.depth)
+            bpp = formats[i].bits_per_pixel;
+    }
+    XFree(formats);
+    if (bpp != 32) {
+        fprintf(stderr, "%s: -capture needs a 32 bpp visual, "
+                "depth %d uses %d bpp.\n", ProgramName, attrs.depth, bpp);
+        return (False);
+    }
+
+    cap_dpy        = dpy;
+    cap_win        = win;
+    cap_path       = path;
+    cap_width      = attrs.width;
+    cap_height     = attrs.height;
+    cap_stride     = (size_t) cap_width * 4;
+    cap_frame_size = cap_stride * cap_height;
+    cap_visual     = attrs.visual;
+    cap_delta      = delta;
+    cap_frames     = frames;
+    cap_count      = 0;
+    cap_stopped    = False;
+    cap_time       = cap_max = 0;
+    cap_mask       = attrs.visual->red_mask | attrs.visual->green_mask |
+                     attrs.visual->blue_mask;
+    cap_size       = CAPTURE_HEADER + cap_frame_size * frames;
+
+    cap_hashes = calloc(frames, sizeof(uint64_t));
+    if (cap_hashes == NULL) {
+        fprintf(stderr, "%s: Cannot allocate %d frame hashes.\n",
+                ProgramName, frames);
+        return (False);
+    }
+    if (!map_file()) {
+        free(cap_hashes);
+        cap_hashes = NULL;
+        return (False);
+    }
+
+    cap_method = CAPTURE_GET_IMAGE;
+    if (XShmQueryVersion(dpy, &major, &minor, &pixmaps)) {
+#ifdef HAVE_XCB_SHM
+        if (attach_file())
+            cap_method = CAPTURE_ATTACH_FD;
+        else
+#endif
+        if (create_shm_image(attrs.visual, attrs.depth))
+            cap_method = CAPTURE_SHM;
+    }
+    if (cap_method == CAPTURE_GET_IMAGE) {
+        /* The data pointer moves through the mapping frame by frame */
+        cap_image = XCreateImage(dpy, attrs.visual, attrs.depth, ZPixmap, 0,
+                                 NULL, cap_width, cap_height, 32,
+                                 (int) cap_stride);
+        if (cap_image == NULL) {
+            fprintf(stderr, "%s: Cannot create the capture image.\n",
+                    ProgramName);
+            capture_close(NULL, NULL);
+            return (False);
+        }
+    }
+    Log(("Capturing %d frames into %s with %s.\n", frames, path,
+         method_names[cap_method]));
+    return (True);
+}
+
+/*
+ * Read the frame the server has just finished from the window and hash
+ * it.  Returns False if it could not be read, e.g. because the window
+ * changed its size; the frames captured so far are kept.
+ */
+Bool capture_frame(void)
+{
+    unsigned char *dst;
+    int64_t        t0, t;
+    Bool           ok = True;
+    int            y;
+
+    if (cap_stopped || cap_count >= cap_frames)
+        return (False);
+    dst = cap_map + CAPTURE_HEADER + cap_frame_size * cap_count;
+    t0  = dizzy_now_ns();
+
+    switch (cap_method) {
+#ifdef HAVE_XCB_SHM
+    case CAPTURE_ATTACH_FD:
+        ok = get_image_fd(dst);
+        break;
+#endif
+    case CAPTURE_SHM:
+        ok = XShmGetImage(cap_dpy, cap_win, cap_image, 0, 0, AllPlanes);
+        for (y = 0; ok && y < cap_height; y++) {
+            memcpy(dst + y * cap_stride,
+                   cap_image->data + (size_t) y * cap_image->bytes_per_line,
+                   cap_stride);
+        }
+        break;
+    default:
+        cap_image->data = (char *) dst;
+        ok = (XGetSubImage(cap_dpy, cap_win, 0, 0, cap_width, cap_height,
+                           AllPlanes, ZPixmap, cap_image, 0, 0) != NULL);
+        cap_image->data = NULL;
+        break;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: Cannot read frame %d back, capture stopped.\n",
+                ProgramName, cap_count);
+        cap_stopped = True;
+        return (False);
+    }
+
+    cap_hashes[cap_count++] = hash_frame(dst, cap_stride, cap_width,
+                                         cap_height, cap_mask);
+    t = dizzy_now_ns() - t0;
+    cap_time += t;
+    if (t > cap_max)
+        cap_max = t;
+    return (True);
+}
+
+/* Write the hashes and report the cost of the capture to |fp| unless it
+ * is NULL, then release everything */
+void capture_close(FILE *fp, const char *prefix)
+{
+    uint64_t combined = 0;
+    char     sums[1040];
+    FILE    *out = NULL;
+    int      i;
+
+    if (fp != NULL) {
+        snprintf(sums, sizeof(sums), "%s.sums", cap_path);
+        out = fopen(sums, "w");
+        if (out == NULL)
+            fprintf(stderr, "%s: Cannot write %s: %s\n", ProgramName, sums,
+                    strerror(errno));
+    }
+    for (i = 0; i < cap_count; i++) {
+        combined = ROTL(combined, 5) ^ cap_hashes[i];
+        if (out != NULL)
+            fprintf(out, "%d %016llx\n", i, (unsigned long long) cap_hashes[i]);
+    }
+    if (out != NULL)
+        fclose(out);
+
+    if (fp != NULL && cap_count > 0) {
+        double mb = (double) cap_frame_size * cap_count / (1024. * 1024.);
+
+        fprintf(fp, "%s: captured %d frames of %dx%d with %s\n", prefix,
+                cap_count, cap_width, cap_height, method_names[cap_method]);
+        fprintf(fp, "%s: capture ms per frame: mean %.3f max %.3f, %.1f MB/s\n",
+                prefix, cap_time / 1e6 / cap_count, cap_max / 1e6,
+                (cap_time > 0) ? mb / (cap_time / 1e9) : 0.);
+        fprintf(fp, "%s: capture hash %016llx, per frame in %s\n", prefix,
+                (unsigned long long) combined, sums);
+    }
+
+#ifdef HAVE_XCB_SHM
+    if (cap_method == CAPTURE_ATTACH_FD) {
+        /* The server must be done with the file before it shrinks */
+        xcb_shm_detach(XGetXCBConnection(cap_dpy), cap_seg);
+        XSync(cap_dpy, False);
+    }
+#endif
+    if (cap_image != NULL) {
+        if (cap_method == CAPTURE_SHM) {
+            XShmDetach(cap_dpy, &cap_shminfo);
+            cap_image->data = NULL;
+            XDestroyImage(cap_image);
+            shmdt(cap_shminfo.shmaddr);
+        }
+        else {
+            XDestroyImage(cap_image);
+        }
+        cap_image = NULL;
+    }
+    if (cap_map != NULL) {
+        write_header();
+        munmap(cap_map, cap_size);
+        /* A capture that stopped early keeps only the frames it has */
+        if (cap_count < cap_frames &&
+            ftruncate(cap_fd, CAPTURE_HEADER + cap_frame_size * cap_count) != 0)
+            Log(("Cannot truncate %s.\n", cap_path));
+    }
+    cap_map = NULL;
+    if (cap_fd >= 0)
+        close(cap_fd);
+    cap_fd = -1;
+    free(cap_hashes);
+    cap_hashes = NULL;
+}
@@ -0,0 +1,214 @@
+/*
+ * xdbedizzy - color allocation
+ *
+ * Allocating the palette one XAllocNamedColor() at a time costs a round
+ * trip per color, which adds up on a remote display.  Instead:
+ *
+ *  - "#rrggbb" and the Xcms forms such as "rgb:r/g/b" are parsed on the
+ *    client by XParseColor() without asking the server.
+ *  - On TrueColor visuals the pixel follows from the RGB value and the
+ *    masks of the visual, so nothing has to be allocated at all.
+ *  - What is left, the lookup or allocation of color names, is sent as
+ *    a batch of requests over the XCB connection underneath Xlib, and
+ *    the replies are collected afterwards: one round trip in total.
+ *
+ * Without libX11-xcb the remaining names are looked up one by one as
+ * before.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "xdbedizzy.h"
+
+#ifdef HAVE_X11_XCB
+#include <X11/Xlib-xcb.h>
+#endif
+
+/* Parse |name| if it needs no server, i.e. is not a color name */
+static
+Bool parse_local(Display *dpy, Colormap cmap, const char *name, XColor *c)
+{
+    if (name[0] != '#' && strchr(name, ':') == NULL)
+        return (False);
+    return (XParseColor(dpy, cmap, name, c) != 0);
+}
+
+/* Scale a 16 bit color channel into the bits of |mask|, to the nearest
+ * level like the server does when allocating on a TrueColor visual */
+static
+unsigned long scale_channel(unsigned short value, unsigned long mask)
+{
+    unsigned long levels;
+    int           shift = 0, bits = 0;
+
+    if (mask == 0)
+        return (0);
+    while (!(mask & 1)) {
+        mask >>= 1;
+        shift++;
+    }
+    while (mask & 1) {
+        mask >>= 1;
+        bits++;
+    }
+    if (bits > 16)
+        bits = 16;
+    levels = (1UL << bits) - 1;
+    return ((((unsigned long)value * levels + 32767) / 65535) << shift);
+}
+
+/* Pixel value of |c| in a TrueColor visual with the given channel
+ * masks; the xcb backend uses it too, so both compute the same pixels */
+unsigned long true_color_pixel(unsigned long red_mask,
+                               unsigned long green_mask,
+                               unsigned long blue_mask, const XColor *c)
+{
+    return (scale_channel(c->red,   red_mask)   |
+            scale_channel(c->green, green_mask) |
+            scale_channel(c->blue,  blue_mask));
+}
+
+static
+void bad_color(const char *name)
+{
+    fprintf(stderr, "%s: Couldn't get color: %s\n", ProgramName, name);
+}
+
+#ifdef HAVE_X11_XCB
+/* Send the requests for all colors in |todo| first, then collect the
+ * replies */
+static
+Bool alloc_batched(Display *dpy, Bool true_color, Colormap cmap,
+                   char *const *names, const XColor *rgb, const Bool *todo,
+                   int n, XColor *colors)
+{
+    xcb_connection_t *c = XGetXCBConnection(dpy);
+    unsigned int      seq[MAX_COLORS];
+    Bool              ok = True;
+    int               i;
+
+    /* Xlib may still hold the CreateColormap request in its buffer */
+    XFlush(dpy);
+
+    for (i = 0; i < n; i++) {
+        if (!todo[i])
+            continue;
+        if (true_color)
+            seq[i] = xcb_lookup_color(c, cmap, strlen(names[i]),
+                                      names[i]).sequence;
+        else if (rgb[i].flags != 0)
+            seq[i] = xcb_alloc_color(c, cmap, rgb[i].red, rgb[i].green,
+                                     rgb[i].blue).sequence;
+        else
+            seq[i] = xcb_alloc_named_color(c, cmap, strlen(names[i]),
+                                           names[i]).sequence;
+    }
+
+    for (i = 0; i < n; i++) {
+        xcb_generic_error_t *err = NULL;
+
+        if (!todo[i])
+            continue;
+        if (true_color) {
+            xcb_lookup_color_cookie_t  ck = { seq[i] };
+            xcb_lookup_color_reply_t  *r  = xcb_lookup_color_reply(c, ck, &err);
+
+            if (r != NULL) {
+                colors[i].red   = r->exact_red;
+                colors[i].green = r->exact_green;
+                colors[i].blue  = r->exact_blue;
+            }
+            free(r);
+        }
+        else if (rgb[i].flags != 0) {
+            xcb_alloc_color_cookie_t  ck = { seq[i] };
+            xcb_alloc_color_reply_t  *r  = xcb_alloc_color_reply(c, ck, &err);
+
+            if (r != NULL)
+                colors[i].pixel = r->pixel;
+            free(r);
+        }
+        else {
+            xcb_alloc_named_color_cookie_t  ck = { seq[i] };
+            xcb_alloc_named_color_reply_t  *r  =
+                xcb_alloc_named_color_reply(c, ck, &err);
+
+            if (r != NULL)
+                colors[i].pixel = r->pixel;
+            free(r);
+        }
+        if (err != NULL) {
+            /* Keep collecting, so no reply is left behind */
+            if (ok)
+                bad_color(names[i]);
+            ok = False;
+            free(err);
+        }
+    }
+    return (ok);
+}
+#endif
+
+/*
+ * Get the pixels of the |n| colors |names| in |cmap|, a colormap for
+ * |visual|, into |pixels|.  Returns False with a message on stderr if a
+ * color cannot be found or allocated.
+ */
+Bool alloc_colors(Display *dpy, Visual *visual, Colormap cmap,
+                  char *const *names, int n, unsigned long *pixels)
+{
+    XColor colors[MAX_COLORS], rgb[MAX_COLORS], exact;
+    Bool   todo[MAX_COLORS];
+    Bool   true_color = (visual->class == TrueColor);
+    int    i, pending = 0;
+
+    for (i = 0; i < n; i++) {
+        memset(&rgb[i], 0, sizeof(rgb[i]));
+        if (parse_local(dpy, cmap, names[i], &rgb[i]))
+            rgb[i].flags = DoRed | DoGreen | DoBlue;
+        colors[i] = rgb[i];
+        /* On TrueColor only names need the server */
+        todo[i] = !(true_color && rgb[i].flags != 0);
+        if (todo[i])
+            pending++;
+    }
+
+#ifdef HAVE_X11_XCB
+    if (pending > 0 && !alloc_batched(dpy, true_color, cmap, names, rgb,
+                                      todo, n, colors))
+        return (False);
+    pending = 0;
+#endif
+
+    for (i = 0; i < n && pending > 0; i++) {
+        Status status;
+
+        if (!todo[i])
+            continue;
+        if (true_color)
+            status = XLookupColor(dpy, cmap, names[i], &colors[i], &exact);
+        else if (rgb[i].flags != 0)
+            status = XAllocColor(dpy, cmap, &colors[i]);
+        else
+            status = XAllocNamedColor(dpy, cmap, names[i], &colors[i], &exact);
+        if (status == 0) {
+            bad_color(names[i]);
+            return (False);
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (true_color)
+            pixels[i] = true_color_pixel(visual->red_mask, visual->green_mask,
+                                         visual->blue_mask, &colors[i]);
+        else
+            pixels[i] = colors[i].pixel;
+    }
+    return (True);
+}
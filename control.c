@@ -0,0 +1,232 @@
+/*
+ * xdbedizzy - control socket (-control)
+ *
+ * A Unix domain stream socket through which scripts tune a running
+ * instance, e.g. to sweep a parameter without paying for the window
+ * and visual setup of a restart every time.  The protocol is plain
+ * text: every line a client sends is a command, split into words at
+ * blanks, and gets exactly one line back that starts with "ok" or
+ * "error".  The commands themselves are implemented by the handler
+ * given to control_open().
+ *
+ * All sockets are non-blocking and watched by the EventLoop of the main
+ * loop, so a client that stalls cannot stall the animation; a reply
+ * that does not fit into the socket buffer is dropped.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "xdbedizzy.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define CONTROL_ARGS 8
+
+static
+Bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0 &&
+            fcntl(fd, F_SETFD, FD_CLOEXEC) == 0);
+}
+
+/*
+ * Listen on the socket |path|; a stale socket left there by an earlier
+ * run is replaced, any other file is not.  Every command is passed to
+ * |handler| along with |data|.  Returns False with a message on stderr
+ * if the socket cannot be created.
+ */
+Bool control_open(ControlServer *cs, const char *path,
+                  ControlHandler handler, void *data)
+{
+    struct sockaddr_un addr;
+    struct stat        st;
+    int                i;
+
+    memset(cs, 0, sizeof(*cs));
+    cs->fd = -1;
+    for (i = 0; i < CONTROL_CLIENTS; i++)
+        cs->clients[i].fd = -1;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: Control socket path too long: %s\n",
+                ProgramName, path);
+        return (False);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+
+    cs->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (cs->fd < 0 || !set_nonblocking(cs->fd) ||
+        bind(cs->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(cs->fd, CONTROL_CLIENTS) < 0) {
+        fprintf(stderr, "%s: Cannot listen on %s: %s\n",
+                ProgramName, path, strerror(errno));
+        if (cs->fd >= 0)
+            close(cs->fd);
+        cs->fd = -1;
+        return (False);
+    }
+    cs->path    = path;
+    cs->handler = handler;
+    cs->data    = data;
+    Log(("Listening for commands on %s.\n", path));
+    return (True);
+}
+
+void control_close(ControlServer *cs)
+{
+    int i;
+
+    if (cs->fd < 0)
+        return;
+    for (i = 0; i < CONTROL_CLIENTS; i++) {
+        if (cs->clients[i].fd >= 0)
+            close(cs->clients[i].fd);
+        cs->clients[i].fd = -1;
+    }
+    close(cs->fd);
+    unlink(cs->path);
+    cs->fd = -1;
+}
+
+static
+void drop_client(EventLoop *el, ControlClient *c)
+{
+    event_loop_unwatch(el, c->fd);
+    close(c->fd);
+    c->fd  = -1;
+    c->len = 0;
+}
+
+static
+void accept_client(ControlServer *cs, EventLoop *el)
+{
+    int fd, i;
+
+    fd = accept(cs->fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    for (i = 0; i < CONTROL_CLIENTS; i++) {
+        if (cs->clients[i].fd < 0)
+            break;
+    }
+    if (i == CONTROL_CLIENTS || !set_nonblocking(fd) ||
+        !event_loop_watch(el, fd)) {
+        close(fd);
+        return;
+    }
+    cs->clients[i].fd  = fd;
+    cs->clients[i].len = 0;
+}
+
+static
+void reply(ControlClient *c, const char *text)
+{
+    char   buf[CONTROL_LINE + 1];
+    size_t len;
+
+    snprintf(buf, sizeof(buf) - 1, "%s", text);
+    len = strlen(buf);
+    buf[len++] = '\n';
+    if (send(c->fd, buf, len, MSG_NOSIGNAL) < 0)
+        Log(("Control reply dropped: %s\n", strerror(errno)));
+}
+
+/* Split |line| into words and run it */
+static
+void run_command(ControlServer *cs, ControlClient *c, char *line)
+{
+    char  *argv[CONTROL_ARGS];
+    char   text[CONTROL_LINE];
+    char  *word, *next;
+    int    argc = 0;
+
+    for (word = strtok_r(line, " \t\r", &next); word != NULL;
+         word = strtok_r(NULL, " \t\r", &next)) {
+        if (argc == CONTROL_ARGS) {
+            reply(c, "error too many arguments");
+            return;
+        }
+        argv[argc++] = word;
+    }
+    if (argc == 0)
+        return;
+
+    text[0] = '\0';
+    cs->handler(cs->data, argc, argv, text, sizeof(text));
+    reply(c, text);
+}
+
+/* Read what |c| sent and run every complete line in it */
+static
+void read_client(ControlServer *cs, EventLoop *el, ControlClient *c)
+{
+    ssize_t n;
+    char   *start, *end;
+
+    n = read(c->fd, c->line + c->len, sizeof(c->line) - c->len);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EINTR))
+            drop_client(el, c);
+        return;
+    }
+    c->len += n;
+
+    start = c->line;
+    while ((end = memchr(start, '\n', c->len - (start - c->line))) != NULL) {
+        *end = '\0';
+        run_command(cs, c, start);
+        start = end + 1;
+    }
+    c->len -= start - c->line;
+    memmove(c->line, start, c->len);
+
+    if (c->len == sizeof(c->line)) {
+        reply(c, "error line too long");
+        drop_client(el, c);
+    }
+}
+
+/*
+ * Serve |fd| if it is the listening socket or one of the clients of
+ * |cs|, which are watched by |el|.  Returns False for any other file
+ * descriptor.
+ */
+Bool control_handle(ControlServer *cs, EventLoop *el, int fd)
+{
+    int i;
+
+    if (cs->fd < 0)
+        return (False);
+    if (fd == cs->fd) {
+        accept_client(cs, el);
+        return (True);
+    }
+    for (i = 0; i < CONTROL_CLIENTS; i++) {
+        if (cs->clients[i].fd == fd) {
+            read_client(cs, el, &cs->clients[i]);
+            return (True);
+        }
+    }
+    return (False);
+}
@@ -0,0 +1,378 @@
+/*
+ * xdbedizzy - per-frame primitive lists
+ *
+ * The scene of a frame is collected into one array of arcs and one
+ * array of segments per GC and sent with as few PolyArc/PolySegment
+ * requests as the server's maximum request size allows, instead of one
+ * request per primitive.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "xdbedizzy.h"
+
+/* Request sizes in 4 byte units, see xPolyArcReq, xArc and xSegment */
+#define POLY_REQ_UNITS  3
+#define ARC_UNITS       3
+#define SEGMENT_UNITS   2
+
+static
+void *grow_array(void *array, int *max, size_t size)
+{
+    int newmax = (*max > 0) ? *max * 2 : 64;
+
+    array = realloc(array, newmax * size);
+    if (array == NULL) {
+        fprintf(stderr, "%s: Out of memory for %d primitives.\n",
+                ProgramName, newmax);
+        exit(EXIT_FAILURE);
+    }
+    *max = newmax;
+    return (array);
+}
+
+static
+PrimBatch *use_batch(DrawList *dl, int color)
+{
+    PrimBatch *b = &dl->batch[color];
+
+    if (b->narcs == 0 && b->nsegs == 0)
+        dl->order[dl->norder++] = color;
+    return (b);
+}
+
+void draw_list_reset(DrawList *dl)
+{
+    int i;
+
+    for (i = 0; i < MAX_COLORS; i++) {
+        dl->batch[i].narcs = 0;
+        dl->batch[i].nsegs = 0;
+    }
+    dl->norder = 0;
+}
+
+void draw_list_free(DrawList *dl)
+{
+    int i;
+
+    int line_width = dl->line_width;
+
+    for (i = 0; i < MAX_COLORS; i++) {
+        free(dl->batch[i].arcs);
+        free(dl->batch[i].segs);
+    }
+    memset(dl, 0, sizeof(*dl));
+    dl->line_width = line_width;
+}
+
+/* Add a full circle/ellipse outline */
+void draw_list_add_arc(DrawList *dl, int color,
+                       int x, int y, int width, int height)
+{
+    PrimBatch *b = use_batch(dl, color);
+    XArc      *a;
+
+    if (b->narcs == b->maxarcs)
+        b->arcs = grow_array(b->arcs, &b->maxarcs, sizeof(XArc));
+    a = &b->arcs[b->narcs++];
+    a->x      = x;
+    a->y      = y;
+    a->width  = width;
+    a->height = height;
+    a->angle1 = 0;
+    a->angle2 = 360 * 64;
+}
+
+/* Add a polyline as |npoints| - 1 segments; with round caps the joints
+ * look like round joins */
+void draw_list_add_polyline(DrawList *dl, int color,
+                            const XPoint *pnt, int npoints)
+{
+    PrimBatch *b = use_batch(dl, color);
+    XSegment  *s;
+    int        i;
+
+    for (i = 1; i < npoints; i++) {
+        if (b->nsegs == b->maxsegs)
+            b->segs = grow_array(b->segs, &b->maxsegs, sizeof(XSegment));
+        s = &b->segs[b->nsegs++];
+        s->x1 = pnt[i - 1].x;
+        s->y1 = pnt[i - 1].y;
+        s->x2 = pnt[i].x;
+        s->y2 = pnt[i].y;
+    }
+}
+
+/* Make room for |narcs| more arcs of |color| and return them; the
+ * caller must fill in all of them */
+XArc *draw_list_reserve_arcs(DrawList *dl, int color, int narcs)
+{
+    PrimBatch *b;
+    XArc      *a;
+
+    if (narcs <= 0)
+        return (dl->batch[color].arcs);
+    b = use_batch(dl, color);
+    while (b->narcs + narcs > b->maxarcs)
+        b->arcs = grow_array(b->arcs, &b->maxarcs, sizeof(XArc));
+    a = b->arcs + b->narcs;
+    b->narcs += narcs;
+    return (a);
+}
+
+/* Make room for |nsegs| more segments of |color| and return them; the
+ * caller must fill in all of them */
+XSegment *draw_list_reserve_segments(DrawList *dl, int color, int nsegs)
+{
+    PrimBatch *b;
+    XSegment  *s;
+
+    if (nsegs <= 0)
+        return (dl->batch[color].segs);
+    b = use_batch(dl, color);
+    while (b->nsegs + nsegs > b->maxsegs)
+        b->segs = grow_array(b->segs, &b->maxsegs, sizeof(XSegment));
+    s = b->segs + b->nsegs;
+    b->nsegs += nsegs;
+    return (s);
+}
+
+/* Number of |item_units| sized items that fit into one poly request */
+static
+int max_request_items(Display *dpy, int item_units)
+{
+    long maxreq = XExtendedMaxRequestSize(dpy);
+    int  header = POLY_REQ_UNITS + 1; /* BIG-REQUESTS length field */
+
+    if (maxreq == 0) {
+        maxreq = XMaxRequestSize(dpy);
+        header = POLY_REQ_UNITS;
+    }
+    return ((int)((maxreq - header) / item_units));
+}
+
+/* Send |n| arcs with as few PolyArc requests as the maximum request
+ * size allows */
+void draw_arcs(Display *dpy, Drawable d, GC gc, const XArc *arcs, int n)
+{
+    int max = max_request_items(dpy, ARC_UNITS);
+    int i, chunk;
+
+    for (i = 0; i < n; i += chunk) {
+        chunk = (n - i > max) ? max : n - i;
+        XDrawArcs(dpy, d, gc, (XArc *) arcs + i, chunk);
+    }
+}
+
+/* The same for segments and PolySegment */
+void draw_segments(Display *dpy, Drawable d, GC gc, const XSegment *segs,
+                   int n)
+{
+    int max = max_request_items(dpy, SEGMENT_UNITS);
+    int i, chunk;
+
+    for (i = 0; i < n; i += chunk) {
+        chunk = (n - i > max) ? max : n - i;
+        XDrawSegments(dpy, d, gc, (XSegment *) segs + i, chunk);
+    }
+}
+
+void draw_list_emit(Display *dpy, Drawable d, GC *gcs, const DrawList *dl)
+{
+    int i;
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+        GC               gc = gcs[dl->order[i]];
+
+        draw_arcs(dpy, d, gc, b->arcs, b->narcs);
+        draw_segments(dpy, d, gc, b->segs, b->nsegs);
+    }
+}
+
+/* Bytes of the poly requests needed for |nitems| items */
+static
+unsigned long request_bytes(Display *dpy, int nitems, int item_units)
+{
+    int           max = max_request_items(dpy, item_units);
+    unsigned long bytes = 0;
+    int           chunk;
+
+    for (; nitems > 0; nitems -= chunk) {
+        chunk = (nitems > max) ? max : nitems;
+        bytes += (POLY_REQ_UNITS + (unsigned long)chunk * item_units) * 4;
+        /* BIG-REQUESTS adds a 32 bit length field */
+        if (POLY_REQ_UNITS + (long)chunk * item_units > 0xffff)
+            bytes += 4;
+    }
+    return (bytes);
+}
+
+/* Bytes of the requests draw_list_emit() sends for |dl| */
+unsigned long draw_list_request_bytes(Display *dpy, const DrawList *dl)
+{
+    unsigned long bytes = 0;
+    int           i;
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+
+        bytes += request_bytes(dpy, b->narcs, ARC_UNITS);
+        bytes += request_bytes(dpy, b->nsegs, SEGMENT_UNITS);
+    }
+    return (bytes);
+}
+
+/* r = bounding box of r and a; an empty rectangle counts as no area */
+void rect_union(XRectangle *r, const XRectangle *a)
+{
+    int x1, y1, x2, y2;
+
+    if (a->width == 0 || a->height == 0)
+        return;
+    if (r->width == 0 || r->height == 0) {
+        *r = *a;
+        return;
+    }
+    x1 = (r->x < a->x) ? r->x : a->x;
+    y1 = (r->y < a->y) ? r->y : a->y;
+    x2 = (r->x + r->width  > a->x + a->width)  ? r->x + r->width  : a->x + a->width;
+    y2 = (r->y + r->height > a->y + a->height) ? r->y + r->height : a->y + a->height;
+    r->x      = x1;
+    r->y      = y1;
+    r->width  = x2 - x1;
+    r->height = y2 - y1;
+}
+
+/* r = r intersected with a; returns False if the result is empty */
+Bool rect_intersect(XRectangle *r, const XRectangle *a)
+{
+    int x1, y1, x2, y2;
+
+    x1 = (r->x > a->x) ? r->x : a->x;
+    y1 = (r->y > a->y) ? r->y : a->y;
+    x2 = (r->x + r->width  < a->x + a->width)  ? r->x + r->width  : a->x + a->width;
+    y2 = (r->y + r->height < a->y + a->height) ? r->y + r->height : a->y + a->height;
+    if (x2 <= x1 || y2 <= y1) {
+        r->width = r->height = 0;
+        return (False);
+    }
+    r->x      = x1;
+    r->y      = y1;
+    r->width  = x2 - x1;
+    r->height = y2 - y1;
+    return (True);
+}
+
+/* True if the ellipse inscribed in |a|, shrunk by |pad|, contains the
+ * point (x, y) */
+static
+Bool inside_ellipse(const XArc *a, int pad, int x, int y)
+{
+    double rx = a->width  / 2. - pad;
+    double ry = a->height / 2. - pad;
+    double dx, dy;
+
+    if (rx <= 0. || ry <= 0.)
+        return (False);
+    dx = (x - (a->x + a->width  / 2.)) / rx;
+    dy = (y - (a->y + a->height / 2.)) / ry;
+    return (dx * dx + dy * dy < 1.);
+}
+
+/* True if the |line_width| wide outline of |a| misses |view| */
+static
+Bool arc_invisible(const XArc *a, const XRectangle *view, int line_width)
+{
+    int pad = line_width / 2 + 1;
+
+    if (a->x + a->width  + pad <= view->x ||
+        a->y + a->height + pad <= view->y ||
+        a->x - pad >= view->x + view->width ||
+        a->y - pad >= view->y + view->height)
+        return (True);
+
+    /* A full ellipse whose hole contains all of |view|; the hole is
+     * convex, so checking the corners is enough */
+    return (a->angle2 >= 360 * 64 &&
+            inside_ellipse(a, pad, view->x, view->y) &&
+            inside_ellipse(a, pad, view->x + view->width, view->y) &&
+            inside_ellipse(a, pad, view->x, view->y + view->height) &&
+            inside_ellipse(a, pad, view->x + view->width,
+                           view->y + view->height));
+}
+
+/*
+ * Drop the arcs of |dl| that draw nothing inside |view| with
+ * |line_width| wide lines: the ones whose bounding box misses |view|,
+ * and full ellipses that enclose all of it.  Returns the number of
+ * arcs dropped.
+ */
+int draw_list_cull_arcs(DrawList *dl, const XRectangle *view, int line_width)
+{
+    int culled = 0;
+    int i, n, kept;
+
+    for (i = 0; i < dl->norder; i++) {
+        PrimBatch *b = &dl->batch[dl->order[i]];
+
+        for (n = kept = 0; n < b->narcs; n++) {
+            if (arc_invisible(&b->arcs[n], view, line_width))
+                culled++;
+            else
+                b->arcs[kept++] = b->arcs[n];
+        }
+        b->narcs = kept;
+    }
+    return (culled);
+}
+
+/* Bounding box of everything in |dl| drawn with |line_width| wide
+ * lines.  Returns False if the list is empty. */
+Bool draw_list_bounds(const DrawList *dl, int line_width, XRectangle *box)
+{
+    int x1 = 0x7fff, y1 = 0x7fff, x2 = -0x8000, y2 = -0x8000;
+    int pad = line_width / 2 + 1;
+    int i, n;
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+
+        for (n = 0; n < b->narcs; n++) {
+            const XArc *a = &b->arcs[n];
+
+            if (a->x < x1) x1 = a->x;
+            if (a->y < y1) y1 = a->y;
+            if (a->x + a->width  > x2) x2 = a->x + a->width;
+            if (a->y + a->height > y2) y2 = a->y + a->height;
+        }
+        for (n = 0; n < b->nsegs; n++) {
+            const XSegment *s = &b->segs[n];
+
+            if (s->x1 < x1) x1 = s->x1;
+            if (s->x2 < x1) x1 = s->x2;
+            if (s->y1 < y1) y1 = s->y1;
+            if (s->y2 < y1) y1 = s->y2;
+            if (s->x1 > x2) x2 = s->x1;
+            if (s->x2 > x2) x2 = s->x2;
+            if (s->y1 > y2) y2 = s->y1;
+            if (s->y2 > y2) y2 = s->y2;
+        }
+    }
+    if (x2 < x1 || y2 < y1) {
+        box->x = box->y = box->width = box->height = 0;
+        return (False);
+    }
+    box->x      = x1 - pad;
+    box->y      = y1 - pad;
+    box->width  = x2 - x1 + 2 * pad;
+    box->height = y2 - y1 + 2 * pad;
+    return (True);
+}
@@ -0,0 +1,191 @@
+/*
+ * xdbedizzy - event loop
+ *
+ * The main loop sleeps until the X connection or the control socket
+ * has input or the next frame is due.  On Linux this is an epoll set
+ * with a timerfd in it that is armed to the absolute frame deadline on
+ * CLOCK_MONOTONIC, the clock of dizzy_now_ns(), so the wakeup lands on
+ * the deadline instead of on a timeout rounded to milliseconds and
+ * relative to whenever the loop got around to computing it.  The
+ * timerfd is only rearmed when the deadline moves.  Elsewhere, or if
+ * the epoll set cannot be created, select() is used with a timeout.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <X11/Xpoll.h>
+#include "xdbedizzy.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#define NSEC_PER_SEC 1000000000LL
+
+void event_loop_init(EventLoop *el)
+{
+    memset(el, 0, sizeof(*el));
+    el->epfd    = -1;
+    el->timerfd = -1;
+
+#ifdef USE_EPOLL
+    {
+        struct epoll_event ev;
+
+        el->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (el->epfd < 0)
+            return;
+        el->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN;
+        ev.data.fd = el->timerfd;
+        if (el->timerfd < 0 ||
+            epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->timerfd, &ev) < 0) {
+            if (el->timerfd >= 0)
+                close(el->timerfd);
+            close(el->epfd);
+            el->epfd = el->timerfd = -1;
+            return;
+        }
+    }
+#endif
+}
+
+void event_loop_fini(EventLoop *el)
+{
+    if (el->timerfd >= 0)
+        close(el->timerfd);
+    if (el->epfd >= 0)
+        close(el->epfd);
+    memset(el, 0, sizeof(*el));
+    el->epfd    = -1;
+    el->timerfd = -1;
+}
+
+/* Wake up when |fd| becomes readable; returns False if too many file
+ * descriptors are watched already */
+Bool event_loop_watch(EventLoop *el, int fd)
+{
+    if (el->nfds >= EVENT_LOOP_FDS)
+        return (False);
+#ifdef USE_EPOLL
+    if (el->epfd >= 0) {
+        struct epoll_event ev;
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            return (False);
+    }
+#endif
+    el->fds[el->nfds++] = fd;
+    return (True);
+}
+
+/* Stop watching |fd|; must be called before it is closed */
+void event_loop_unwatch(EventLoop *el, int fd)
+{
+    int i;
+
+    for (i = 0; i < el->nfds; i++) {
+        if (el->fds[i] == fd)
+            break;
+    }
+    if (i == el->nfds)
+        return;
+    el->fds[i] = el->fds[--el->nfds];
+#ifdef USE_EPOLL
+    if (el->epfd >= 0)
+        epoll_ctl(el->epfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+}
+
+#ifdef USE_EPOLL
+static
+int epoll_wait_fds(EventLoop *el, int64_t deadline, int *ready, int max)
+{
+    struct epoll_event events[EVENT_LOOP_FDS + 1];
+    int                i, n, nready = 0;
+
+    if (deadline != el->armed) {
+        struct itimerspec its;
+
+        /* A zero it_value disarms the timer */
+        memset(&its, 0, sizeof(its));
+        its.it_value.tv_sec  = deadline / NSEC_PER_SEC;
+        its.it_value.tv_nsec = deadline % NSEC_PER_SEC;
+        timerfd_settime(el->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+        el->armed = deadline;
+    }
+
+    n = epoll_wait(el->epfd, events, EVENT_LOOP_FDS + 1, -1);
+    for (i = 0; i < n; i++) {
+        if (events[i].data.fd == el->timerfd) {
+            uint64_t expirations;
+
+            /* One shot; the next deadline arms it again */
+            if (read(el->timerfd, &expirations, sizeof(expirations)) > 0)
+                el->armed = 0;
+        }
+        else if (nready < max) {
+            ready[nready++] = events[i].data.fd;
+        }
+    }
+    return (nready);
+}
+#endif
+
+/*
+ * Sleep until one of the watched file descriptors is readable or
+ * |deadline|, a dizzy_now_ns() time, has passed; 0 waits without a
+ * deadline.  Stores the readable file descriptors in |ready| and
+ * returns their number, 0 on timeout or when a signal arrived.
+ */
+int event_loop_wait(EventLoop *el, int64_t deadline, int *ready, int max)
+{
+    fd_set         select_mask;
+    struct timeval timeout, *tp = NULL;
+    int            i, n, maxfd = -1, nready = 0;
+
+#ifdef USE_EPOLL
+    if (el->epfd >= 0)
+        return (epoll_wait_fds(el, deadline, ready, max));
+#endif
+
+    FD_ZERO(&select_mask);
+    for (i = 0; i < el->nfds; i++) {
+        FD_SET(el->fds[i], &select_mask);
+        if (el->fds[i] > maxfd)
+            maxfd = el->fds[i];
+    }
+    if (deadline != 0) {
+        int64_t wait = deadline - dizzy_now_ns();
+
+        if (wait < 0)
+            wait = 0;
+        /* Round up so we do not wake up just before the deadline */
+        wait = (wait + 999) / 1000;
+        timeout.tv_sec  = wait / 1000000;
+        timeout.tv_usec = wait % 1000000;
+        tp = &timeout;
+    }
+
+    n = select(maxfd + 1, &select_mask, NULL, NULL, tp);
+    if (n <= 0)
+        return (0);
+    for (i = 0; i < el->nfds && nready < max; i++) {
+        if (FD_ISSET(el->fds[i], &select_mask))
+            ready[nready++] = el->fds[i];
+    }
+    return (nready);
+}
@@ -0,0 +1,307 @@
+/*
+ * xdbedizzy - spoke geometry
+ *
+ * The spokes only differ from frame to frame by |rotation|, so the
+ * cos/sin of the per-spoke base angles are cached and rebuilt only when
+ * the number of spokes changes.  Each frame then rotates the cached
+ * unit vectors by the three rotation angles of the spoke points (one
+ * cos/sin pair each) and scales them to the window.  The points are
+ * produced in structure-of-arrays form so the loop maps directly onto
+ * SSE2; a scalar loop is used on other CPUs and for the tail.
+ *
+ * With tens of thousands of spokes most of them cover the same pixels:
+ * spokes less than a pixel apart at the rim are merged, i.e. only every
+ * |stride|-th one is computed and drawn.  The lines are LINE_WIDTH wide,
+ * so the result looks the same, and the number of segments stays
+ * bounded by the circumference of the window instead of growing with
+ * the spoke count.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "xdbedizzy.h"
+
+/* Default radius ratios and angular lag of the outer spoke points */
+static const double spoke_ratio[SPOKE_POINTS] = { RATIO1, RATIO2, RATIO3 };
+static const double spoke_lag[SPOKE_POINTS]   = { 0.0,    0.1,    0.2    };
+
+void spoke_geometry_init(SpokeGeometry *g)
+{
+    memset(g, 0, sizeof(*g));
+    memcpy(g->ratio, spoke_ratio, sizeof(g->ratio));
+    memcpy(g->lag, spoke_lag, sizeof(g->lag));
+    g->simd  = True;
+    g->merge = True;
+}
+
+static
+void free_tables(SpokeGeometry *g)
+{
+    int k;
+
+    free(g->cos_base);
+    free(g->sin_base);
+    g->cos_base = g->sin_base = NULL;
+    for (k = 0; k < SPOKE_POINTS; k++) {
+        free(g->x[k]);
+        free(g->y[k]);
+        g->x[k] = g->y[k] = NULL;
+    }
+    g->capacity = 0;
+}
+
+/* Free the tables; the ratios, lags and flags of |g| are kept */
+void spoke_geometry_free(SpokeGeometry *g)
+{
+    free_tables(g);
+    g->spokes = g->requested = g->stride = 0;
+}
+
+static
+void *alloc_array(size_t n, size_t size)
+{
+    void *p = malloc(n * size);
+
+    if (p == NULL) {
+        fprintf(stderr, "%s: Out of memory for %lu spokes.\n",
+                ProgramName, (unsigned long)n);
+        exit(EXIT_FAILURE);
+    }
+    return (p);
+}
+
+/* Rebuild the base angle tables for every |stride|-th of |spokes| spokes */
+static
+void build_tables(SpokeGeometry *g, int spokes, int stride)
+{
+    int i, k, n = (spokes + stride - 1) / stride;
+
+    if (n > g->capacity) {
+        free_tables(g);
+        /* Round up so the SIMD loop can always load whole vectors */
+        g->capacity = (n + 3) & ~3;
+        g->cos_base = alloc_array(g->capacity, sizeof(float));
+        g->sin_base = alloc_array(g->capacity, sizeof(float));
+        for (k = 0; k < SPOKE_POINTS; k++) {
+            g->x[k] = alloc_array(g->capacity, sizeof(short));
+            g->y[k] = alloc_array(g->capacity, sizeof(short));
+        }
+    }
+    for (i = 0; i < n; i++) {
+        g->cos_base[i] = (float) cos((double)i * stride * S_ANGLE(spokes));
+        g->sin_base[i] = (float) sin((double)i * stride * S_ANGLE(spokes));
+    }
+    g->requested = spokes;
+    g->stride    = stride;
+    g->spokes    = n;
+}
+
+/*
+ * Radius of the rim the spokes around (cx, cy) are thinned out on.  The
+ * outer spoke points lie on an ellipse with the half axes |ratio| * cx
+ * and |ratio| * cy; the rim is the longer one, where neighbouring spokes
+ * are farthest apart, so spokes found closer than a gap there are
+ * closer than that everywhere.
+ */
+double spoke_rim(double ratio, int cx, int cy)
+{
+    return (ratio * ((cx > cy) ? cx : cy));
+}
+
+/* Stride that leaves every stride-th of |spokes| spokes at least |gap|
+ * pixels apart on a rim of radius |rim|, see spoke_rim() */
+int spoke_stride(int spokes, double rim, double gap)
+{
+    double spacing, stride;
+
+    if (spokes <= 0)
+        return (1);
+    spacing = 2. * M_PI * rim / spokes;
+    if (spacing >= gap)
+        return (1);
+    stride = ceil(gap / spacing);
+    return ((int) stride);
+}
+
+/* Merge spokes less than a pixel apart */
+static
+int merge_stride(const SpokeGeometry *g, int spokes, int cx, int cy)
+{
+    return (spoke_stride(spokes, spoke_rim(g->ratio[SPOKE_POINTS - 1], cx, cy),
+                         1.));
+}
+
+/*
+ * out = center + (int)(rotate(base, angle) * radius) for spokes
+ * [first, n).  The (int) truncation matches the original double code.
+ */
+static
+void rotate_scalar(const SpokeGeometry *g, int first, int n,
+                   float cr, float sr, float rx, float ry, int cx, int cy,
+                   short *xout, short *yout)
+{
+    int i;
+
+    for (i = first; i < n; i++) {
+        float c = g->cos_base[i] * cr - g->sin_base[i] * sr;
+        float s = g->sin_base[i] * cr + g->cos_base[i] * sr;
+
+        xout[i] = (short)((int)(c * rx) + cx);
+        yout[i] = (short)((int)(s * ry) + cy);
+    }
+}
+
+#ifdef __SSE2__
+/* Same as rotate_scalar() for four spokes at a time; returns the
+ * number of spokes handled */
+static
+int rotate_sse2(const SpokeGeometry *g, int n,
+                float cr, float sr, float rx, float ry, int cx, int cy,
+                short *xout, short *yout)
+{
+    const __m128  vcr = _mm_set1_ps(cr);
+    const __m128  vsr = _mm_set1_ps(sr);
+    const __m128  vrx = _mm_set1_ps(rx);
+    const __m128  vry = _mm_set1_ps(ry);
+    const __m128i vcx = _mm_set1_epi32(cx);
+    const __m128i vcy = _mm_set1_epi32(cy);
+    int           i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128  cb = _mm_loadu_ps(g->cos_base + i);
+        __m128  sb = _mm_loadu_ps(g->sin_base + i);
+        __m128  c  = _mm_sub_ps(_mm_mul_ps(cb, vcr), _mm_mul_ps(sb, vsr));
+        __m128  s  = _mm_add_ps(_mm_mul_ps(sb, vcr), _mm_mul_ps(cb, vsr));
+        __m128i xi = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(c, vrx)), vcx);
+        __m128i yi = _mm_add_epi32(_mm_cvttps_epi32(_mm_mul_ps(s, vry)), vcy);
+
+        _mm_storel_epi64((__m128i *)(xout + i), _mm_packs_epi32(xi, xi));
+        _mm_storel_epi64((__m128i *)(yout + i), _mm_packs_epi32(yi, yi));
+    }
+    return (i);
+}
+#endif
+
+/*
+ * Compute the three outer points of every spoke for |rotation| in a
+ * window whose center is (cx, cy).  The tables are rebuilt only when
+ * the number of spokes or the merge stride change.
+ */
+void spoke_geometry_update(SpokeGeometry *g, int spokes, double rotation,
+                           int cx, int cy)
+{
+    int k, stride;
+
+    if (spokes <= 0) {
+        g->spokes = g->requested = 0;
+        return;
+    }
+    stride = g->merge ? merge_stride(g, spokes, cx, cy) : 1;
+    if (spokes != g->requested || stride != g->stride)
+        build_tables(g, spokes, stride);
+
+    for (k = 0; k < SPOKE_POINTS; k++) {
+        float cr = (float) cos(rotation - g->lag[k]);
+        float sr = (float) sin(rotation - g->lag[k]);
+        float rx = (float) (g->ratio[k] * cx);
+        float ry = (float) (g->ratio[k] * cy);
+        int   done = 0;
+
+#ifdef __SSE2__
+        if (g->simd)
+            done = rotate_sse2(g, g->spokes, cr, sr, rx, ry, cx, cy,
+                               g->x[k], g->y[k]);
+#endif
+        rotate_scalar(g, done, g->spokes, cr, sr, rx, ry, cx, cy,
+                      g->x[k], g->y[k]);
+    }
+    g->cx = cx;
+    g->cy = cy;
+}
+
+/* Append the spokes computed by spoke_geometry_update() to |dl| as
+ * three segments each: center -> p0 -> p1 -> p2 */
+void spoke_geometry_emit(const SpokeGeometry *g, DrawList *dl, int color)
+{
+    XSegment *s = draw_list_reserve_segments(dl, color,
+                                              SPOKE_POINTS * g->spokes);
+    int       i;
+
+    for (i = 0; i < g->spokes; i++) {
+        s[0].x1 = g->cx;       s[0].y1 = g->cy;
+        s[0].x2 = g->x[0][i];  s[0].y2 = g->y[0][i];
+        s[1].x1 = g->x[0][i];  s[1].y1 = g->y[0][i];
+        s[1].x2 = g->x[1][i];  s[1].y2 = g->y[1][i];
+        s[2].x1 = g->x[1][i];  s[2].y1 = g->y[1][i];
+        s[2].x2 = g->x[2][i];  s[2].y2 = g->y[2][i];
+        s += SPOKE_POINTS;
+    }
+}
+
+/* Reference implementation: the per-spoke trig of the original redraw() */
+static
+void spokes_reference(SpokeGeometry *g, int spokes, double rotation,
+                      int cx, int cy)
+{
+    int i, k;
+
+    for (i = 0; i < spokes; i++) {
+        for (k = 0; k < SPOKE_POINTS; k++) {
+            double a = i * S_ANGLE(spokes) + rotation - g->lag[k];
+
+            g->x[k][i] = (int) (cos(a) * (g->ratio[k] * cx)) + cx;
+            g->y[k][i] = (int) (sin(a) * (g->ratio[k] * cy)) + cy;
+        }
+    }
+}
+
+/*
+ * Time |iterations| frames of spoke geometry for |spokes| spokes with
+ * the reference, scalar and (if available) SSE2 kernels, and print the
+ * throughput in spoke points per second.  Needs no X display.
+ */
+void spoke_geometry_bench(FILE *fp, int spokes, int iterations)
+{
+    static const char *names[] = { "reference", "scalar", "sse2" };
+    SpokeGeometry g;
+    int           kernel, n;
+    int64_t       t0, t1;
+    double        points;
+
+    spoke_geometry_init(&g);
+    g.merge = False;
+    build_tables(&g, spokes, 1);
+    points = (double)spokes * SPOKE_POINTS * iterations;
+
+    for (kernel = 0; kernel < 3; kernel++) {
+#ifndef __SSE2__
+        if (kernel == 2)
+            break;
+#endif
+        g.simd = (kernel == 2);
+        t0 = dizzy_now_ns();
+        for (n = 0; n < iterations; n++) {
+            if (kernel == 0)
+                spokes_reference(&g, spokes, n * 0.05, 200, 200);
+            else
+                spoke_geometry_update(&g, spokes, n * 0.05, 200, 200);
+        }
+        t1 = dizzy_now_ns();
+        fprintf(fp, "%s: %-9s %d spokes x %d frames: %.3f ms/frame, "
+                "%.1f Mpoints/s\n",
+                ProgramName, names[kernel], spokes, iterations,
+                (t1 - t0) / 1e6 / iterations,
+                (t1 > t0) ? points / ((t1 - t0) / 1e9) / 1e6 : 0.);
+    }
+    spoke_geometry_free(&g);
+}
@@ -0,0 +1,122 @@
+/*
+ * xdbedizzy - frames in flight limit (-maxlag)
+ *
+ * After every frame the client sets a SYNC counter to the frame number.
+ * The server executes requests in order, so the counter reaches N only
+ * once it has processed everything up to and including frame N.  An
+ * alarm on the counter sends an AlarmNotify event for every new value,
+ * which tells the client asynchronously, without a round trip, how far
+ * the server has got.  A new frame is only started while fewer than
+ * |max| frames are outstanding, which bounds the latency between
+ * issuing a frame and the server drawing it, instead of letting the
+ * request queue grow on a slow or remote server.
+ *
+ * Without the SYNC extension every |max|th frame ends with an XSync()
+ * round trip instead.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include "xdbedizzy.h"
+
+static
+void set_value(XSyncValue *v, uint64_t x)
+{
+    XSyncIntsToValue(v, (unsigned int)(x & 0xffffffff), (int)(x >> 32));
+}
+
+static
+uint64_t get_value(XSyncValue v)
+{
+    return (((uint64_t)(uint32_t)XSyncValueHigh32(v) << 32) |
+            XSyncValueLow32(v));
+}
+
+/* Limit |fl| to |max| frames in flight on |dpy|, 0 disables the limit */
+void frame_lag_init(FrameLag *fl, Display *dpy, int max)
+{
+    XSyncAlarmAttributes attrs;
+    int                  error_base, major, minor;
+
+    memset(fl, 0, sizeof(*fl));
+    fl->dpy = dpy;
+    fl->max = max;
+    if (max <= 0)
+        return;
+
+    if (!XSyncQueryExtension(dpy, &fl->event_base, &error_base) ||
+        !XSyncInitialize(dpy, &major, &minor)) {
+        Log(("SYNC not available, -maxlag uses XSync().\n"));
+        return;
+    }
+
+    set_value(&attrs.trigger.wait_value, 0);
+    fl->counter = XSyncCreateCounter(dpy, attrs.trigger.wait_value);
+
+    /* Fire whenever the counter reaches the next frame number */
+    attrs.trigger.counter    = fl->counter;
+    attrs.trigger.value_type = XSyncAbsolute;
+    attrs.trigger.test_type  = XSyncPositiveComparison;
+    set_value(&attrs.trigger.wait_value, 1);
+    set_value(&attrs.delta, 1);
+    attrs.events             = True;
+    fl->alarm = XSyncCreateAlarm(dpy,
+                                 XSyncCACounter | XSyncCAValueType |
+                                 XSyncCAValue | XSyncCATestType |
+                                 XSyncCADelta | XSyncCAEvents,
+                                 &attrs);
+    fl->use_sync = True;
+}
+
+void frame_lag_fini(FrameLag *fl)
+{
+    if (fl->use_sync) {
+        XSyncDestroyAlarm(fl->dpy, fl->alarm);
+        XSyncDestroyCounter(fl->dpy, fl->counter);
+    }
+    fl->use_sync = False;
+}
+
+/* Mark the end of a frame in the request stream */
+void frame_lag_mark(FrameLag *fl)
+{
+    XSyncValue v;
+
+    if (fl->max <= 0)
+        return;
+    fl->submitted++;
+    if (fl->use_sync) {
+        set_value(&v, fl->submitted);
+        XSyncSetCounter(fl->dpy, fl->counter, v);
+    }
+    else if (fl->submitted - fl->completed >= (uint64_t)fl->max) {
+        XSync(fl->dpy, False);
+        fl->completed = fl->submitted;
+    }
+}
+
+/* True if another frame may be started */
+Bool frame_lag_ready(const FrameLag *fl)
+{
+    return (fl->max <= 0 || fl->submitted - fl->completed < (uint64_t)fl->max);
+}
+
+/* Returns True if |ev| was an AlarmNotify for |fl|; it is consumed then */
+Bool frame_lag_handle_event(FrameLag *fl, const XEvent *ev)
+{
+    const XSyncAlarmNotifyEvent *ae = (const XSyncAlarmNotifyEvent *)ev;
+    uint64_t                     value;
+
+    if (!fl->use_sync || ev->type != fl->event_base + XSyncAlarmNotify ||
+        ae->alarm != fl->alarm)
+        return (False);
+    value = get_value(ae->counter_value);
+    if (value > fl->completed)
+        fl->completed = value;
+    return (True);
+}
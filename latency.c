@@ -0,0 +1,182 @@
+/*
+ * xdbedizzy - input to swap latency probe (-latency)
+ *
+ * A probe moves the pointer into the window and injects a click of
+ * button 1 or 2 with the XTEST extension, which also works on Xvfb.
+ * The click changes |delta| like a real one.  The probe is timed from
+ * the moment it was sent to the ButtonPress coming back, and from there
+ * to the first swap after it: that frame is the first one rendered with
+ * the new state.  An XSync() after the swap waits until the server has
+ * executed it.  The buttons alternate, so |delta| returns to where it
+ * was after every two probes.
+ *
+ * Only one probe is in flight at a time, and the next one is sent
+ * LATENCY_GAP after the last one completed, so probes do not queue up
+ * behind each other.  A probe that has not completed after
+ * LATENCY_TIMEOUT, e.g. because the window was paused or the click went
+ * elsewhere, is counted as lost.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <X11/extensions/XTest.h>
+#include "xdbedizzy.h"
+
+#define LATENCY_GAP     50000000LL      /* ns between probes */
+#define LATENCY_TIMEOUT 1000000000LL    /* ns until a probe is lost */
+#define HIST_BUCKETS    10              /* < 1 ms, < 2 ms, ... < 256 ms, more */
+#define HIST_WIDTH      50              /* characters of the longest bar */
+
+/* Returns False if the server has no XTEST extension */
+Bool latency_init(LatencyProbe *lp, Display *dpy, int probes)
+{
+    int event_base, error_base, major, minor;
+
+    memset(lp, 0, sizeof(*lp));
+    if (!XTestQueryExtension(dpy, &event_base, &error_base, &major, &minor)) {
+        fprintf(stderr, "%s: The XTEST extension is not available.\n",
+                ProgramName);
+        return (False);
+    }
+    lp->input = calloc(2 * (size_t)probes, sizeof(int64_t));
+    if (lp->input == NULL) {
+        fprintf(stderr, "%s: Cannot allocate %d latency samples.\n",
+                ProgramName, probes);
+        return (False);
+    }
+    lp->total  = lp->input + probes;
+    lp->max    = probes;
+    lp->button = 1;
+    return (True);
+}
+
+void latency_fini(LatencyProbe *lp)
+{
+    free(lp->input);
+    memset(lp, 0, sizeof(*lp));
+}
+
+/* Click into the |width| x |height| window |win| unless a probe is in
+ * flight or the next one is not due yet */
+void latency_inject(LatencyProbe *lp, Display *dpy, Window win,
+                    int width, int height, int64_t now)
+{
+    Window child;
+    int    x, y;
+
+    if (lp->injected != 0 && now - lp->injected > LATENCY_TIMEOUT) {
+        Log(("Latency probe lost.\n"));
+        lp->injected = 0;
+        lp->lost++;
+    }
+    if (lp->injected != 0 || lp->count >= lp->max || now < lp->next)
+        return;
+
+    /* The round trip of the translation is not part of the probe */
+    if (!XTranslateCoordinates(dpy, win, DefaultRootWindow(dpy),
+                               width / 2, height / 2, &x, &y, &child))
+        return;
+    XTestFakeMotionEvent(dpy, DefaultScreen(dpy), x, y, CurrentTime);
+
+    lp->injected = dizzy_now_ns();
+    lp->received = 0;
+    XTestFakeButtonEvent(dpy, lp->button, True, CurrentTime);
+    XTestFakeButtonEvent(dpy, lp->button, False, CurrentTime);
+    XFlush(dpy);
+    lp->button = (lp->button == 1) ? 2 : 1;
+}
+
+/* A ButtonPress arrived at |now|; returns True if it is the probe */
+Bool latency_input(LatencyProbe *lp, int64_t now)
+{
+    if (lp->injected == 0 || lp->received != 0)
+        return (False);
+    lp->received = now;
+    return (True);
+}
+
+/* Called after every swap; completes the probe if its ButtonPress has
+ * been handled.  Returns True once all probes are done. */
+Bool latency_swapped(LatencyProbe *lp, Display *dpy)
+{
+    int64_t now;
+
+    if (lp->injected == 0 || lp->received == 0)
+        return (lp->count >= lp->max);
+
+    XSync(dpy, False);
+    now = dizzy_now_ns();
+    lp->input[lp->count] = lp->received - lp->injected;
+    lp->total[lp->count] = now - lp->injected;
+    lp->count++;
+    lp->injected = 0;
+    lp->next     = now + LATENCY_GAP;
+    return (lp->count >= lp->max);
+}
+
+static
+void report_samples(FILE *fp, const char *prefix, const char *what,
+                    const int64_t *sorted, int n)
+{
+    fprintf(fp, "%s: %s ms: p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+            prefix, what,
+            samples_percentile_ms(sorted, n, 50),
+            samples_percentile_ms(sorted, n, 95),
+            samples_percentile_ms(sorted, n, 99), sorted[n - 1] / 1e6);
+}
+
+/* Percentiles of both latencies and a histogram of the input to swap
+ * latency in power of two buckets */
+void latency_report(FILE *fp, const char *prefix, const LatencyProbe *lp)
+{
+    int64_t *sorted;
+    int      hist[HIST_BUCKETS];
+    int      n = lp->count, most = 0, i, b;
+
+    fprintf(fp, "%s: %d latency probes, %d lost\n", prefix, n, lp->lost);
+    if (n == 0)
+        return;
+
+    sorted = malloc(n * sizeof(int64_t));
+    if (sorted == NULL)
+        return;
+    memcpy(sorted, lp->input, n * sizeof(int64_t));
+    samples_sort(sorted, n);
+    report_samples(fp, prefix, "input to event", sorted, n);
+    memcpy(sorted, lp->total, n * sizeof(int64_t));
+    samples_sort(sorted, n);
+    report_samples(fp, prefix, "input to swap", sorted, n);
+    free(sorted);
+
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < n; i++) {
+        int64_t ms = lp->total[i] / 1000000;
+
+        for (b = 0; b < HIST_BUCKETS - 1 && ms >= (1 << b); b++)
+            ;
+        hist[b]++;
+    }
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        if (hist[b] > most)
+            most = hist[b];
+    }
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        int bar = (hist[b] * HIST_WIDTH + most - 1) / most;
+
+        if (b < HIST_BUCKETS - 1)
+            fprintf(fp, "%s:   < %3d ms %6d", prefix, 1 << b, hist[b]);
+        else
+            fprintf(fp, "%s:  >= %3d ms %6d", prefix, 1 << (b - 1), hist[b]);
+        if (bar > 0)
+            fputc(' ', fp);
+        for (i = 0; i < bar; i++)
+            fputc('#', fp);
+        fputc('\n', fp);
+    }
+}
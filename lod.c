@@ -0,0 +1,119 @@
+/*
+ * xdbedizzy - adaptive level of detail (-lod)
+ *
+ * The governor is fed the cost of every frame: the time from the point
+ * the frame could have started (its deadline, or the moment it had to
+ * start waiting for the server) until its requests were flushed.  The
+ * cost is smoothed and compared with the frame period.  When it stays
+ * above LOD_HIGH of the period for LOD_DOWN_FRAMES frames the detail is
+ * lowered one level; when it stays below LOD_LOW for LOD_UP_FRAMES
+ * frames it is raised again.  The wide gap between the two thresholds
+ * and the longer wait before raising keep the level from oscillating.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <math.h>
+#include "xdbedizzy.h"
+
+#define LOD_HIGH        0.9     /* of the frame period */
+#define LOD_LOW         0.5
+#define LOD_DOWN_FRAMES 10
+#define LOD_UP_FRAMES   60
+
+typedef struct {
+    int  spoke_merge;   /* 0: all spokes, n: drop overlapping ones, then
+                         * 2^(n-1) times fewer */
+    int  ring_step;     /* draw every ring_step-th ring */
+    Bool frame_skip;    /* render every other frame only */
+} LodLevel;
+
+static const LodLevel levels[] = {
+    { 0, 1, False },    /* full detail */
+    { 1, 1, False },    /* no overlapping spokes */
+    { 1, 2, False },    /* half the rings */
+    { 2, 2, False },    /* half the remaining spokes */
+    { 2, 4, True  },    /* quarter of the rings, half the frames */
+};
+
+#define NUM_LEVELS ((int)(sizeof(levels) / sizeof(levels[0])))
+
+/* Govern for frames of |period| ns; a period of 0 disables the governor */
+void lod_init(LodGovernor *lod, int64_t period)
+{
+    memset(lod, 0, sizeof(*lod));
+    lod->period = period;
+}
+
+/* Feed the cost of one frame in ns; returns True if the level changed */
+Bool lod_update(LodGovernor *lod, int64_t cost)
+{
+    if (lod->period == 0)
+        return (False);
+
+    if (lod->avg == 0.)
+        lod->avg = cost;
+    else
+        lod->avg += (cost - lod->avg) / 8.;
+
+    if (lod->avg > LOD_HIGH * lod->period) {
+        lod->under = 0;
+        if (++lod->over >= LOD_DOWN_FRAMES && lod->level < NUM_LEVELS - 1) {
+            lod->level++;
+            lod->over = 0;
+            lod->changes++;
+            return (True);
+        }
+    }
+    else if (lod->avg < LOD_LOW * lod->period) {
+        lod->over = 0;
+        if (++lod->under >= LOD_UP_FRAMES && lod->level > 0) {
+            lod->level--;
+            lod->under = 0;
+            lod->changes++;
+            return (True);
+        }
+    }
+    else {
+        lod->over = lod->under = 0;
+    }
+    return (False);
+}
+
+/*
+ * Number of spokes to draw out of |spokes| whose outer ends lie on a
+ * rim of radius |rim|, see spoke_rim(), and are |line_width| wide.
+ * Spokes closer than their width at the rim overlap each other, so
+ * dropping them changes little on screen.  What is left is at least a
+ * pixel apart, so the merging of spoke_geometry_update() does not thin
+ * it out any further.
+ */
+int lod_spokes(const LodGovernor *lod, int spokes, double rim, int line_width)
+{
+    int merge = levels[lod->level].spoke_merge;
+    int stride;
+
+    if (merge == 0 || spokes <= 0)
+        return (spokes);
+
+    /* Zero wide lines are drawn one pixel wide */
+    stride = spoke_stride(spokes, rim, (line_width > 1) ? line_width : 1)
+             << (merge - 1);
+    return ((spokes + stride - 1) / stride);
+}
+
+int lod_ring_step(const LodGovernor *lod)
+{
+    return (levels[lod->level].ring_step);
+}
+
+/* True if frame number |frame| should not be rendered */
+Bool lod_skip_frame(const LodGovernor *lod, unsigned long frame)
+{
+    return (levels[lod->level].frame_skip && (frame & 1));
+}
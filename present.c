@@ -0,0 +1,297 @@
+/*
+ * xdbedizzy - Present extension backend (-backend present)
+ *
+ * Frames are drawn with the core protocol into a small pool of window
+ * sized pixmaps and shown with PresentPixmap.  Unlike XdbeSwapBuffers,
+ * every presentation is answered by a PresentCompleteNotify event that
+ * tells when (UST, MSC) and how (flip, copy or skipped) the frame
+ * reached the screen, and by a PresentIdleNotify event once its pixmap
+ * may be drawn into again.  The main loop uses that feedback for
+ * pacing: no new frame is started while PRESENT_MAX_INFLIGHT frames are
+ * still queued in the server, so rendering runs at most one frame ahead
+ * of the vertical blank.
+ *
+ * Each frame targets the first MSC after the one predicted for the time
+ * it is submitted; a frame that completes at a later MSC was missed.
+ * The prediction relies on the UST being CLOCK_MONOTONIC in
+ * microseconds, which is what the X.Org server uses.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <X11/extensions/Xpresent.h>
+#include "xdbedizzy.h"
+
+#define PRESENT_POOL          3     /* pixmaps to render into */
+#define PRESENT_MAX_INFLIGHT  2     /* presentations not completed yet */
+#define PRESENT_QUEUE         8     /* serials remembered, power of 2 */
+
+typedef struct {
+    Pixmap pixmap;
+    Bool   busy;        /* presented and not idle yet */
+} PresentBuffer;
+
+static Display       *present_dpy;
+static Window         present_win;
+static int            present_depth;
+static int            present_opcode;
+static XID            present_eid;
+static PresentBuffer  pool[PRESENT_POOL];
+static int            current = -1;
+static int            pool_width, pool_height;
+
+static uint32_t       serial;                   /* of the last submission */
+static int            inflight;
+static int64_t        submit_time[PRESENT_QUEUE];
+static uint64_t       submit_msc[PRESENT_QUEUE];
+static uint64_t       target_msc;               /* of the last submission */
+
+/* Last completion, for predicting the MSC of the next vertical blank */
+static Bool           have_msc;
+static uint64_t       last_msc, last_ust;
+static uint64_t       msc_period_us;
+
+/* Statistics for present_report() */
+static unsigned long  submitted, completed, flips, copies, missed, skipped;
+static int            max_inflight;
+static int64_t        latency_sum, latency_max;
+
+static
+void destroy_pool(void)
+{
+    int i;
+
+    /* The server keeps pixmaps that are still queued alive */
+    for (i = 0; i < PRESENT_POOL; i++) {
+        if (pool[i].pixmap != None)
+            XFreePixmap(present_dpy, pool[i].pixmap);
+        pool[i].pixmap = None;
+        pool[i].busy   = False;
+    }
+    current = -1;
+    pool_width = pool_height = 0;
+}
+
+/* Returns False if the server has no usable Present extension */
+Bool present_init(Display *dpy, Window win, int depth)
+{
+    int event_base, error_base, major = 1, minor = 0;
+
+    if (!XPresentQueryExtension(dpy, &present_opcode, &event_base, &error_base) ||
+        !XPresentQueryVersion(dpy, &major, &minor)) {
+        fprintf(stderr, "%s: The Present extension is not available.\n",
+                ProgramName);
+        return (False);
+    }
+    Log(("Present %d.%d.\n", major, minor));
+
+    present_dpy   = dpy;
+    present_win   = win;
+    present_depth = depth;
+    present_eid   = XPresentSelectInput(dpy, win,
+                                        PresentCompleteNotifyMask |
+                                        PresentIdleNotifyMask);
+    return (True);
+}
+
+void present_fini(void)
+{
+    destroy_pool();
+    XPresentFreeInput(present_dpy, present_win, present_eid);
+}
+
+static
+void complete_notify(const XPresentCompleteNotifyEvent *ce)
+{
+    int64_t  latency;
+    uint64_t target;
+
+    if (ce->kind != PresentCompleteKindPixmap)
+        return;
+
+    if (inflight > 0)
+        inflight--;
+    completed++;
+    latency = dizzy_now_ns() - submit_time[ce->serial_number & (PRESENT_QUEUE - 1)];
+    latency_sum += latency;
+    if (latency > latency_max)
+        latency_max = latency;
+
+    switch (ce->mode) {
+    case PresentCompleteModeFlip:
+        flips++;
+        break;
+    case PresentCompleteModeSkip:
+        /* Replaced by a later frame before it was shown */
+        skipped++;
+        return;
+    default:
+        copies++;
+        break;
+    }
+    target = submit_msc[ce->serial_number & (PRESENT_QUEUE - 1)];
+    if (target != 0 && ce->msc > target)
+        missed++;
+
+    if (have_msc && ce->msc > last_msc && ce->ust > last_ust)
+        msc_period_us = (ce->ust - last_ust) / (ce->msc - last_msc);
+    last_msc = ce->msc;
+    last_ust = ce->ust;
+    have_msc = True;
+}
+
+static
+void idle_notify(const XPresentIdleNotifyEvent *ie)
+{
+    int i;
+
+    for (i = 0; i < PRESENT_POOL; i++) {
+        if (pool[i].pixmap == ie->pixmap)
+            pool[i].busy = False;
+    }
+}
+
+/* Returns True if |ev| was a Present event; it is consumed in that case */
+Bool present_handle_event(XEvent *ev)
+{
+    XGenericEventCookie *cookie = &ev->xcookie;
+
+    if (ev->type != GenericEvent || cookie->extension != present_opcode)
+        return (False);
+    if (!XGetEventData(present_dpy, cookie))
+        return (True);
+
+    switch (cookie->evtype) {
+    case PresentCompleteNotify:
+        complete_notify(cookie->data);
+        break;
+    case PresentIdleNotify:
+        idle_notify(cookie->data);
+        break;
+    }
+    XFreeEventData(present_dpy, cookie);
+    return (True);
+}
+
+static
+int idle_buffer(void)
+{
+    int i;
+
+    for (i = 0; i < PRESENT_POOL; i++) {
+        if (!pool[i].busy)
+            return (i);
+    }
+    return (-1);
+}
+
+/* True if a new frame may be started without waiting for the server */
+Bool present_ready(void)
+{
+    return (inflight < PRESENT_MAX_INFLIGHT &&
+            (pool_width == 0 || idle_buffer() >= 0));
+}
+
+static
+Bool is_present_event(Display *dpy, XEvent *ev, XPointer arg)
+{
+    (void) dpy;
+    (void) arg;
+    return (ev->type == GenericEvent && ev->xcookie.extension == present_opcode);
+}
+
+/* Process Present events until at most |max| frames are in flight and
+ * a pixmap is idle; other events stay queued */
+void present_wait(int max)
+{
+    XEvent ev;
+
+    while (inflight > max || (pool_width != 0 && idle_buffer() < 0)) {
+        XIfEvent(present_dpy, &ev, is_present_event, NULL);
+        present_handle_event(&ev);
+    }
+}
+
+/* An idle |width| x |height| pixmap to draw the next frame into.  Its
+ * content is undefined. */
+Pixmap present_next_pixmap(int width, int height)
+{
+    int i;
+
+    if (width != pool_width || height != pool_height) {
+        destroy_pool();
+        for (i = 0; i < PRESENT_POOL; i++) {
+            pool[i].pixmap = XCreatePixmap(present_dpy, present_win,
+                                           width, height, present_depth);
+        }
+        pool_width  = width;
+        pool_height = height;
+    }
+    present_wait(PRESENT_MAX_INFLIGHT - 1);
+    current = idle_buffer();
+    return (pool[current].pixmap);
+}
+
+/* First MSC the server can still show a frame at, 0 if unknown yet.
+ * A target MSC of 0 means the next vertical blank. */
+static
+uint64_t predict_msc(void)
+{
+    uint64_t now_us;
+
+    if (!have_msc)
+        return (0);
+    now_us = (uint64_t)dizzy_now_ns() / 1000;
+    if (msc_period_us == 0 || now_us <= last_ust)
+        return (last_msc + 1);
+    return (last_msc + (now_us - last_ust) / msc_period_us + 1);
+}
+
+/* Present the pixmap returned by the last present_next_pixmap() call
+ * at the next vertical blank not taken by an earlier frame */
+void present_submit(void)
+{
+    uint64_t msc;
+
+    if (current < 0)
+        return;
+
+    msc = predict_msc();
+    if (msc != 0 && msc <= target_msc)
+        msc = target_msc + 1;
+    target_msc = msc;
+
+    serial++;
+    submit_time[serial & (PRESENT_QUEUE - 1)] = dizzy_now_ns();
+    submit_msc[serial & (PRESENT_QUEUE - 1)]  = msc;
+    XPresentPixmap(present_dpy, present_win, pool[current].pixmap, serial,
+                   None, None, 0, 0, None, None, None,
+                   PresentOptionNone, msc, 0, 0, NULL, 0);
+    pool[current].busy = True;
+    current = -1;
+
+    submitted++;
+    if (++inflight > max_inflight)
+        max_inflight = inflight;
+}
+
+void present_report(FILE *fp)
+{
+    fprintf(fp, "%s: present: %lu frames submitted, %lu completed "
+            "(%lu flips, %lu copies), %lu missed, %lu skipped, "
+            "max %d in flight\n",
+            ProgramName, submitted, completed, flips, copies,
+            missed, skipped, max_inflight);
+    if (completed > 0) {
+        fprintf(fp, "%s: present: submit to complete ms: avg %.3f max %.3f, "
+                "refresh %.3f ms\n",
+                ProgramName, latency_sum / 1e6 / completed, latency_max / 1e6,
+                msc_period_us / 1e3);
+    }
+}
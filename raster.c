@@ -0,0 +1,461 @@
+/*
+ * xdbedizzy - client side software rasterizer (-backend shm)
+ *
+ * Rasterizes a DrawList into a 32 bits per pixel XImage on the client
+ * and presents it with XShmPutImage, or XPutImage when MIT-SHM cannot be
+ * used (e.g. on a remote display).  Both the stroked arcs and the round
+ * capped segments are convex per scanline, so every primitive is reduced
+ * to one or two spans per row.  This is an aliased span filler: a pixel
+ * is drawn when its center is inside the primitive and left alone
+ * otherwise, there is no per-pixel coverage.  Only filling the spans is
+ * vectorized, four pixels at a time with SSE2 where available.
+ *
+ * Two images are used in turn and an image is only drawn into again
+ * after the server reported the completion of its previous XShmPutImage.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/Xutil.h>
+#include <X11/extensions/XShm.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "xdbedizzy.h"
+
+#define NUM_IMAGES 2
+
+typedef struct {
+    XImage          *image;
+    XShmSegmentInfo  shminfo;
+    Bool             shm;       /* shared with the server */
+    Bool             busy;      /* XShmPutImage not completed yet */
+} RasterImage;
+
+static Display     *raster_dpy;
+static Visual      *raster_visual;
+static int          raster_depth;
+static Bool         raster_use_shm;
+static int          completion_type;
+static RasterImage  images[NUM_IMAGES];
+static int          current;
+static int          raster_width, raster_height;
+static Bool         attach_failed;
+
+/* Pixels of the image being drawn */
+static uint32_t    *fb;
+static int          fb_stride;  /* in pixels */
+
+/* ceil() and floor() as ints; x is well inside the range of an int */
+static
+int iceil(double x)
+{
+    double r = ceil(x);
+
+    return ((int) r);
+}
+
+static
+int ifloor(double x)
+{
+    double r = floor(x);
+
+    return ((int) r);
+}
+
+/* Byte order of the uint32_t pixels written by fill_span() */
+static
+int native_byte_order(void)
+{
+    const uint32_t one = 1;
+
+    return ((*(const unsigned char *)&one == 1) ? LSBFirst : MSBFirst);
+}
+
+static
+void fill_span(int y, int x1, int x2, uint32_t pixel)
+{
+    uint32_t *p;
+    int       n;
+
+    if (y < 0 || y >= raster_height)
+        return;
+    if (x1 < 0)
+        x1 = 0;
+    if (x2 >= raster_width)
+        x2 = raster_width - 1;
+    if (x2 < x1)
+        return;
+
+    p = fb + (size_t)y * fb_stride + x1;
+    n = x2 - x1 + 1;
+#ifdef __SSE2__
+    {
+        __m128i v = _mm_set1_epi32((int)pixel);
+
+        for (; n >= 4; n -= 4, p += 4)
+            _mm_storeu_si128((__m128i *)p, v);
+    }
+#endif
+    while (n-- > 0)
+        *p++ = pixel;
+}
+
+/* Outline of an ellipse stroked |line_width| wide: per row, the part of
+ * the outer ellipse that is not inside the inner ellipse */
+static
+void raster_arc(const XArc *a, int line_width, uint32_t pixel)
+{
+    double hw = line_width / 2.;
+    double cx = a->x + a->width  / 2.;
+    double cy = a->y + a->height / 2.;
+    double ox = a->width  / 2. + hw, oy = a->height / 2. + hw;
+    double ix = a->width  / 2. - hw, iy = a->height / 2. - hw;
+    int    y, y1, y2;
+
+    y1 = iceil(cy - oy);
+    y2 = ifloor(cy + oy);
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= raster_height)
+        y2 = raster_height - 1;
+
+    for (y = y1; y <= y2; y++) {
+        double dy = y - cy;
+        double t  = 1. - (dy * dy) / (oy * oy);
+        double ow, iw;
+
+        if (t < 0.)
+            continue;
+        ow = ox * sqrt(t);
+        if (ix > 0. && iy > 0. && fabs(dy) < iy) {
+            iw = ix * sqrt(1. - (dy * dy) / (iy * iy));
+            fill_span(y, iceil(cx - ow), iceil(cx - iw) - 1, pixel);
+            fill_span(y, ifloor(cx + iw) + 1, ifloor(cx + ow), pixel);
+        }
+        else {
+            fill_span(y, iceil(cx - ow), ifloor(cx + ow), pixel);
+        }
+    }
+}
+
+/* Intersect [*lo, *hi] with the x for which lo_c <= a * x + b <= hi_c */
+static
+void clip_linear(double a, double b, double lo_c, double hi_c,
+                 double *lo, double *hi)
+{
+    double x1, x2;
+
+    if (fabs(a) < 1e-12) {
+        if (b < lo_c || b > hi_c)
+            *hi = *lo - 1.;
+        return;
+    }
+    x1 = (lo_c - b) / a;
+    x2 = (hi_c - b) / a;
+    if (x1 > x2) {
+        double t = x1;
+
+        x1 = x2;
+        x2 = t;
+    }
+    if (x1 > *lo)
+        *lo = x1;
+    if (x2 < *hi)
+        *hi = x2;
+}
+
+/* Extend [*lo, *hi] by the part of row y inside the cap disc at (px, py) */
+static
+void cap_span(double px, double py, double y, double r,
+              double *lo, double *hi)
+{
+    double dy = y - py;
+    double w;
+
+    if (fabs(dy) > r)
+        return;
+    w = sqrt(r * r - dy * dy);
+    if (px - w < *lo)
+        *lo = px - w;
+    if (px + w > *hi)
+        *hi = px + w;
+}
+
+/* A |line_width| wide segment with round caps.  The shape is convex, so
+ * every row is a single span: the union of the band around the segment
+ * and the two cap discs. */
+static
+void raster_segment(const XSegment *s, int line_width, uint32_t pixel)
+{
+    double hw = line_width / 2.;
+    double dx = s->x2 - s->x1, dy = s->y2 - s->y1;
+    double len = sqrt(dx * dx + dy * dy);
+    int    y, y1, y2;
+
+    y1 = iceil(((s->y1 < s->y2) ? s->y1 : s->y2) - hw);
+    y2 = ifloor(((s->y1 > s->y2) ? s->y1 : s->y2) + hw);
+    if (y1 < 0)
+        y1 = 0;
+    if (y2 >= raster_height)
+        y2 = raster_height - 1;
+
+    for (y = y1; y <= y2; y++) {
+        double lo = 1e9, hi = -1e9;
+
+        if (len > 0.) {
+            double blo = -1e9, bhi = 1e9;
+
+            /* |normal . (p - p1)| <= hw */
+            clip_linear(-dy / len, (dx * (y - s->y1)) / len + dy * s->x1 / len,
+                        -hw, hw, &blo, &bhi);
+            /* 0 <= dir . (p - p1) <= len^2 */
+            clip_linear(dx, dy * (y - s->y1) - dx * s->x1,
+                        0., len * len, &blo, &bhi);
+            if (blo <= bhi) {
+                lo = blo;
+                hi = bhi;
+            }
+        }
+        cap_span(s->x1, s->y1, y, hw, &lo, &hi);
+        cap_span(s->x2, s->y2, y, hw, &lo, &hi);
+        if (lo <= hi)
+            fill_span(y, iceil(lo), ifloor(hi), pixel);
+    }
+}
+
+static
+int shm_error_handler(Display *dpy, XErrorEvent *ev)
+{
+    (void) dpy;
+    (void) ev;
+    attach_failed = True;
+    return (0);
+}
+
+static
+void destroy_image(RasterImage *ri)
+{
+    if (ri->image == NULL)
+        return;
+    if (ri->shm) {
+        XShmDetach(raster_dpy, &ri->shminfo);
+        ri->image->data = NULL;
+        XDestroyImage(ri->image);
+        shmdt(ri->shminfo.shmaddr);
+    }
+    else {
+        XDestroyImage(ri->image);   /* frees the data too */
+    }
+    ri->image = NULL;
+    ri->shm   = False;
+    ri->busy  = False;
+}
+
+static
+Bool create_shm_image(RasterImage *ri, int width, int height)
+{
+    int (*old_handler)(Display *, XErrorEvent *);
+
+    ri->image = XShmCreateImage(raster_dpy, raster_visual, raster_depth,
+                                ZPixmap, NULL, &ri->shminfo, width, height);
+    if (ri->image == NULL)
+        return (False);
+    /* The server reads shared memory as it is, in its own byte order */
+    if (ri->image->byte_order != native_byte_order()) {
+        XDestroyImage(ri->image);
+        ri->image = NULL;
+        return (False);
+    }
+    ri->shminfo.shmid = shmget(IPC_PRIVATE,
+                               ri->image->bytes_per_line * ri->image->height,
+                               IPC_CREAT | 0600);
+    if (ri->shminfo.shmid < 0) {
+        XDestroyImage(ri->image);
+        ri->image = NULL;
+        return (False);
+    }
+    ri->shminfo.shmaddr  = ri->image->data = shmat(ri->shminfo.shmid, NULL, 0);
+    ri->shminfo.readOnly = False;
+    if (ri->shminfo.shmaddr == (char *)-1) {
+        shmctl(ri->shminfo.shmid, IPC_RMID, NULL);
+        ri->image->data = NULL;
+        XDestroyImage(ri->image);
+        ri->image = NULL;
+        return (False);
+    }
+
+    /* Attaching fails when the server cannot see our memory, e.g. on a
+     * remote display, so find out synchronously.  Errors of earlier
+     * requests must reach the handler that was installed for them. */
+    XSync(raster_dpy, False);
+    attach_failed = False;
+    old_handler = XSetErrorHandler(shm_error_handler);
+    XShmAttach(raster_dpy, &ri->shminfo);
+    XSync(raster_dpy, False);
+    XSetErrorHandler(old_handler);
+    shmctl(ri->shminfo.shmid, IPC_RMID, NULL);
+
+    if (attach_failed) {
+        ri->image->data = NULL;
+        XDestroyImage(ri->image);
+        ri->image = NULL;
+        shmdt(ri->shminfo.shmaddr);
+        return (False);
+    }
+    return (True);
+}
+
+static
+Bool create_image(RasterImage *ri, int width, int height)
+{
+    if (raster_use_shm) {
+        if ((ri->shm = create_shm_image(ri, width, height)))
+            return (True);
+        Log(("MIT-SHM unusable, falling back to XPutImage.\n"));
+        raster_use_shm = False;
+    }
+    ri->image = XCreateImage(raster_dpy, raster_visual, raster_depth,
+                             ZPixmap, 0, NULL, width, height, 32, 0);
+    if (ri->image == NULL)
+        return (False);
+    /* The image holds native pixels; XPutImage() swaps them for a
+     * server of the other byte order */
+    ri->image->byte_order = native_byte_order();
+    ri->image->data = malloc(ri->image->bytes_per_line * height);
+    return (ri->image->data != NULL);
+}
+
+/*
+ * Prepare the rasterizer for |visual|.  Only 32 bits per pixel ZPixmap
+ * formats are supported.  Returns False if the visual cannot be used.
+ */
+Bool raster_init(Display *dpy, Visual *visual, int depth)
+{
+    XPixmapFormatValues *formats;
+    int                  i, n, bpp = 0;
+
+    formats = XListPixmapFormats(dpy, &n);
+    for (i = 0; i < n; i++) {
+        if (formats[i].depth == depth)
+            bpp = formats[i].bits_per_pixel;
+    }
+    XFree(formats);
+    if (bpp != 32) {
+        fprintf(stderr, "%s: The shm backend needs a 32 bpp visual, "
+                "depth %d uses %d bpp.\n", ProgramName, depth, bpp);
+        return (False);
+    }
+
+    raster_dpy     = dpy;
+    raster_visual  = visual;
+    raster_depth   = depth;
+    raster_use_shm = XShmQueryExtension(dpy);
+    if (raster_use_shm)
+        completion_type = XShmGetEventBase(dpy) + ShmCompletion;
+    else
+        Log(("MIT-SHM not available, using XPutImage.\n"));
+    return (True);
+}
+
+void raster_fini(void)
+{
+    int i;
+
+    for (i = 0; i < NUM_IMAGES; i++)
+        destroy_image(&images[i]);
+    raster_width = raster_height = 0;
+}
+
+/* Returns True if |ev| was a ShmCompletion event for one of our images */
+Bool raster_handle_event(const XEvent *ev)
+{
+    int i;
+
+    if (!raster_use_shm || ev->type != completion_type)
+        return (False);
+    for (i = 0; i < NUM_IMAGES; i++) {
+        if (images[i].shm &&
+            ((const XShmCompletionEvent *)ev)->shmseg == images[i].shminfo.shmseg)
+            images[i].busy = False;
+    }
+    return (True);
+}
+
+static
+Bool is_completion(Display *dpy, XEvent *ev, XPointer arg)
+{
+    (void) dpy;
+    return (ev->type == completion_type &&
+            ((XShmCompletionEvent *)ev)->shmseg == ((RasterImage *)arg)->shminfo.shmseg);
+}
+
+/* Rasterize |dl| over a |bg| background into the next free image */
+void raster_draw(const DrawList *dl, const unsigned long *pixels,
+                 unsigned long bg, int width, int height)
+{
+    RasterImage *ri;
+    int          i, n, y;
+
+    if (width != raster_width || height != raster_height) {
+        raster_fini();
+        for (i = 0; i < NUM_IMAGES; i++) {
+            if (!create_image(&images[i], width, height)) {
+                fprintf(stderr, "%s: Cannot create a %dx%d image.\n",
+                        ProgramName, width, height);
+                exit(EXIT_FAILURE);
+            }
+        }
+        raster_width  = width;
+        raster_height = height;
+    }
+
+    current = (current + 1) % NUM_IMAGES;
+    ri = &images[current];
+    if (ri->busy) {
+        XEvent ev;
+
+        XIfEvent(raster_dpy, &ev, is_completion, (XPointer)ri);
+        ri->busy = False;
+    }
+
+    fb        = (uint32_t *)ri->image->data;
+    fb_stride = ri->image->bytes_per_line / 4;
+    for (y = 0; y < height; y++)
+        fill_span(y, 0, width - 1, (uint32_t)bg);
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b     = &dl->batch[dl->order[i]];
+        uint32_t         pixel = (uint32_t)pixels[dl->order[i]];
+
+        for (n = 0; n < b->narcs; n++)
+            raster_arc(&b->arcs[n], dl->line_width, pixel);
+        for (n = 0; n < b->nsegs; n++)
+            raster_segment(&b->segs[n], dl->line_width, pixel);
+    }
+}
+
+/* Send the image drawn last to |d| */
+void raster_present(Drawable d, GC gc)
+{
+    RasterImage *ri = &images[current];
+
+    if (ri->shm) {
+        XShmPutImage(raster_dpy, d, gc, ri->image, 0, 0, 0, 0,
+                     raster_width, raster_height, True);
+        ri->busy = True;
+    }
+    else {
+        XPutImage(raster_dpy, d, gc, ri->image, 0, 0, 0, 0,
+                  raster_width, raster_height);
+    }
+}
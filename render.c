@@ -0,0 +1,307 @@
+/*
+ * xdbedizzy - XRender backend (-backend render)
+ *
+ * The DrawList of a frame is tessellated on the client: every stroked
+ * arc becomes a band of quads along the ellipse, every segment a quad
+ * with a half disc fan at either end for the round caps of the core
+ * GCs.  The triangles of one color are sent with a single
+ * XRenderCompositeTriangles call through an A8 mask, so the server
+ * renders them antialiased instead of going through its wide line
+ * code.  The source of each call is a solid fill Picture created once
+ * at startup, one per color like the GCs.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <X11/extensions/Xrender.h>
+#include "xdbedizzy.h"
+
+#define CAP_STEPS       4       /* triangles per round cap */
+#define ARC_TOLERANCE   0.25    /* max distance of a chord from the arc */
+#define RENDER_TARGETS  4       /* drawables with a Picture */
+
+typedef struct {
+    Drawable   drawable;
+    Picture    picture;
+    Bool       clipped;
+    XRectangle clip;
+} RenderTarget;
+
+static Display           *render_dpy;
+static XRenderPictFormat *render_format;
+static XRenderPictFormat *mask_format;
+static Picture            fills[MAX_COLORS];
+static int                nfills;
+static RenderTarget       targets[RENDER_TARGETS];
+
+static XTriangle         *tris;
+static int                ntris, maxtris;
+
+/* Returns False if the server has no usable RENDER extension */
+Bool render_init(Display *dpy, Visual *visual, Colormap cmap,
+                 const unsigned long *pixels, int npixels)
+{
+    XColor       colors[MAX_COLORS];
+    XRenderColor c;
+    int          event_base, error_base, i;
+
+    if (!XRenderQueryExtension(dpy, &event_base, &error_base)) {
+        fprintf(stderr, "%s: The RENDER extension is not available.\n",
+                ProgramName);
+        return (False);
+    }
+    render_format = XRenderFindVisualFormat(dpy, visual);
+    mask_format   = XRenderFindStandardFormat(dpy, PictStandardA8);
+    if (render_format == NULL || mask_format == NULL) {
+        fprintf(stderr, "%s: No RENDER format for the visual.\n",
+                ProgramName);
+        return (False);
+    }
+    render_dpy = dpy;
+
+    for (i = 0; i < npixels; i++)
+        colors[i].pixel = pixels[i];
+    XQueryColors(dpy, cmap, colors, npixels);
+    nfills = npixels;
+    for (i = 0; i < npixels; i++) {
+        c.red   = colors[i].red;
+        c.green = colors[i].green;
+        c.blue  = colors[i].blue;
+        c.alpha = 0xffff;
+        fills[i] = XRenderCreateSolidFill(dpy, &c);
+    }
+    return (True);
+}
+
+/* Free the Picture of |d|; must be called before |d| is destroyed */
+void render_forget(Drawable d)
+{
+    int i;
+
+    for (i = 0; i < RENDER_TARGETS; i++) {
+        if (targets[i].drawable == d && d != None) {
+            XRenderFreePicture(render_dpy, targets[i].picture);
+            memset(&targets[i], 0, sizeof(targets[i]));
+        }
+    }
+}
+
+void render_fini(void)
+{
+    int i;
+
+    for (i = 0; i < RENDER_TARGETS; i++)
+        render_forget(targets[i].drawable);
+    for (i = 0; i < nfills; i++)
+        XRenderFreePicture(render_dpy, fills[i]);
+    free(tris);
+    tris = NULL;
+    ntris = maxtris = 0;
+}
+
+static
+RenderTarget *get_target(Drawable d)
+{
+    RenderTarget *free_slot = NULL;
+    int           i;
+
+    for (i = 0; i < RENDER_TARGETS; i++) {
+        if (targets[i].drawable == d)
+            return (&targets[i]);
+        if (targets[i].drawable == None && free_slot == NULL)
+            free_slot = &targets[i];
+    }
+    if (free_slot == NULL) {
+        /* Only the window, its back buffer and the ring cache are ever
+         * drawn into, so this does not happen */
+        free_slot = &targets[0];
+        render_forget(free_slot->drawable);
+    }
+    free_slot->drawable = d;
+    free_slot->picture  = XRenderCreatePicture(render_dpy, d, render_format,
+                                               0, NULL);
+    free_slot->clipped  = False;
+    return (free_slot);
+}
+
+static
+void set_target_clip(RenderTarget *t, const XRectangle *clip)
+{
+    XRenderPictureAttributes attrs;
+
+    if (clip == NULL) {
+        if (t->clipped) {
+            attrs.clip_mask = None;
+            XRenderChangePicture(render_dpy, t->picture, CPClipMask, &attrs);
+            t->clipped = False;
+        }
+        return;
+    }
+    if (t->clipped && !memcmp(&t->clip, clip, sizeof(*clip)))
+        return;
+    XRenderSetPictureClipRectangles(render_dpy, t->picture, 0, 0, clip, 1);
+    t->clip    = *clip;
+    t->clipped = True;
+}
+
+static
+XTriangle *add_triangles(int n)
+{
+    XTriangle *t;
+
+    if (ntris + n > maxtris) {
+        maxtris = (maxtris == 0) ? 1024 : maxtris;
+        while (ntris + n > maxtris)
+            maxtris *= 2;
+        tris = realloc(tris, maxtris * sizeof(XTriangle));
+        if (tris == NULL) {
+            fprintf(stderr, "%s: Out of memory\n", ProgramName);
+            exit(EXIT_FAILURE);
+        }
+    }
+    t = &tris[ntris];
+    ntris += n;
+    return (t);
+}
+
+static
+void set_point(XPointFixed *p, double x, double y)
+{
+    p->x = XDoubleToFixed(x);
+    p->y = XDoubleToFixed(y);
+}
+
+static
+void add_quad(double x0, double y0, double x1, double y1,
+              double x2, double y2, double x3, double y3)
+{
+    XTriangle *t = add_triangles(2);
+
+    set_point(&t[0].p1, x0, y0);
+    set_point(&t[0].p2, x1, y1);
+    set_point(&t[0].p3, x2, y2);
+    set_point(&t[1].p1, x0, y0);
+    set_point(&t[1].p2, x2, y2);
+    set_point(&t[1].p3, x3, y3);
+}
+
+/* Stroke |a| with |line_width| wide lines as a band of quads */
+static
+void tessellate_arc(const XArc *a, int line_width)
+{
+    double h  = line_width / 2.;
+    double rx = a->width  / 2.;
+    double ry = a->height / 2.;
+    double cx = a->x + rx;
+    double cy = a->y + ry;
+    double r  = ((rx > ry) ? rx : ry) + h;
+    double t0 = a->angle1 / 64. * M_PI / 180.;
+    double sweep = a->angle2 / 64. * M_PI / 180.;
+    double step, chords, c0, s0;
+    int    n, i;
+
+    if (sweep > 2. * M_PI)
+        sweep = 2. * M_PI;
+    else if (sweep < -2. * M_PI)
+        sweep = -2. * M_PI;
+
+    /* Chords no further than ARC_TOLERANCE from the outer edge */
+    step = (r > ARC_TOLERANCE) ? 2. * acos(1. - ARC_TOLERANCE / r) : M_PI / 4.;
+    chords = ceil(fabs(sweep) / step);
+    n = (int) chords;
+    if (n < 8)
+        n = 8;
+    step = sweep / n;
+
+    c0 = cos(t0);
+    s0 = sin(t0);
+    for (i = 1; i <= n; i++) {
+        double c1 = cos(t0 + i * step);
+        double s1 = sin(t0 + i * step);
+        double ix = (rx > h) ? rx - h : 0.;
+        double iy = (ry > h) ? ry - h : 0.;
+
+        /* X angles run counterclockwise with y pointing down */
+        add_quad(cx + (rx + h) * c0, cy - (ry + h) * s0,
+                 cx + (rx + h) * c1, cy - (ry + h) * s1,
+                 cx + ix * c1,       cy - iy * s1,
+                 cx + ix * c0,       cy - iy * s0);
+        c0 = c1;
+        s0 = s1;
+    }
+}
+
+/* Half disc of radius |h| around (x, y) from angle |start| on */
+static
+void add_cap(double x, double y, double h, double start)
+{
+    XTriangle *t = add_triangles(CAP_STEPS);
+    int        i;
+
+    for (i = 0; i < CAP_STEPS; i++) {
+        double a0 = start - i * M_PI / CAP_STEPS;
+        double a1 = start - (i + 1) * M_PI / CAP_STEPS;
+
+        set_point(&t[i].p1, x, y);
+        set_point(&t[i].p2, x + h * cos(a0), y + h * sin(a0));
+        set_point(&t[i].p3, x + h * cos(a1), y + h * sin(a1));
+    }
+}
+
+/* Stroke |s| with |line_width| wide lines and round caps */
+static
+void tessellate_segment(const XSegment *s, int line_width)
+{
+    double h  = line_width / 2.;
+    double dx = s->x2 - s->x1;
+    double dy = s->y2 - s->y1;
+    double len = sqrt(dx * dx + dy * dy);
+    double nx, ny, dir;
+
+    if (len == 0.) {
+        add_cap(s->x1, s->y1, h, M_PI / 2.);
+        add_cap(s->x1, s->y1, h, -M_PI / 2.);
+        return;
+    }
+    nx  = -dy / len * h;
+    ny  =  dx / len * h;
+    dir = atan2(dy, dx);
+    add_quad(s->x1 + nx, s->y1 + ny, s->x2 + nx, s->y2 + ny,
+             s->x2 - nx, s->y2 - ny, s->x1 - nx, s->y1 - ny);
+    add_cap(s->x2, s->y2, h, dir + M_PI / 2.);
+    add_cap(s->x1, s->y1, h, dir - M_PI / 2.);
+}
+
+/*
+ * Draw |dl| into |d| with one XRenderCompositeTriangles request per
+ * color (split by Xlib if it exceeds the maximum request size).  |clip|
+ * limits the drawing to one rectangle, NULL draws everywhere.
+ */
+void render_draw(Drawable d, const XRectangle *clip, const DrawList *dl)
+{
+    RenderTarget *t = get_target(d);
+    int           i, n;
+
+    set_target_clip(t, clip);
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+
+        ntris = 0;
+        for (n = 0; n < b->narcs; n++)
+            tessellate_arc(&b->arcs[n], dl->line_width);
+        for (n = 0; n < b->nsegs; n++)
+            tessellate_segment(&b->segs[n], dl->line_width);
+        if (ntris == 0)
+            continue;
+        XRenderCompositeTriangles(render_dpy, PictOpOver,
+                                  fills[dl->order[i]], t->picture,
+                                  mask_format, 0, 0, tris, ntris);
+    }
+}
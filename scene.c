@@ -0,0 +1,437 @@
+/*
+ * xdbedizzy - scene descriptions (-scene)
+ *
+ * A scene file is a text file with one directive per line; '#' starts
+ * a comment:
+ *
+ *     background <color>
+ *     linewidth <pixels>
+ *     rings <color> count=<n> radius=<px> step=<px>
+ *     spokes <color> count=<n> radii=<r1>,<r2>,<r3>
+ *            phase=<a1>,<a2>,<a3> speed=<factor>
+ *
+ * Colors are X color names; every distinct one gets a GC of its own.
+ * Rings are circles around the wobbling center with radii radius,
+ * radius + step, ...  Spokes run from the window center through three
+ * points at the given fractions of the half window size, each lagging
+ * behind the rotation by its phase in radians.  Omitted values keep
+ * the defaults of the built-in scene, which is written in the same
+ * language below; the spoke count defaults to -spokes.
+ *
+ * A scene is compiled once per window into SceneLists, so that drawing
+ * a frame only translates the prebuilt rings and rotates the spokes.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include "xdbedizzy.h"
+
+#define SCENE_LINE 512
+#define MAX_LINE_WIDTH 256
+
+/* The scene xdbedizzy has always drawn */
+static const char *default_scene[] = {
+    "background black",
+    "linewidth 8",
+    "rings orange count=7 radius=50 step=30",
+    "rings green  count=7 radius=55 step=30",
+    "rings blue   count=7 radius=60 step=30",
+    "spokes pink  radii=0.4,0.7,0.95 phase=0,0.1,0.2",
+    NULL
+};
+
+static
+void scene_error(const char *path, int lineno, const char *msg,
+                 const char *arg)
+{
+    fprintf(stderr, "%s: %s:%d: %s%s%s\n", ProgramName, path, lineno, msg,
+            arg ? " " : "", arg ? arg : "");
+}
+
+static
+char *copy_string(const char *str)
+{
+    char *copy = strdup(str);
+
+    if (copy == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+    return (copy);
+}
+
+/* Palette index of color |name|, adding it if new; -1 if it is full */
+static
+int intern_color(Scene *s, const char *name)
+{
+    int i;
+
+    for (i = 0; i < s->ncolors; i++) {
+        if (!strcasecmp(s->colors[i], name))
+            return (i);
+    }
+    if (s->ncolors == MAX_COLORS)
+        return (-1);
+    s->colors[s->ncolors] = copy_string(name);
+    return (s->ncolors++);
+}
+
+/* Parse |n| comma separated numbers; returns False on junk */
+static
+Bool parse_numbers(const char *str, double *v, int n)
+{
+    char *end;
+    int   i;
+
+    for (i = 0; i < n; i++) {
+        errno = 0;
+        v[i] = strtod(str, &end);
+        if (errno != 0 || end == str)
+            return (False);
+        if (i < n - 1 && *end++ != ',')
+            return (False);
+        str = end;
+    }
+    return (*str == '\0');
+}
+
+static
+Bool parse_count(const char *str, int *count)
+{
+    double v;
+
+    if (!parse_numbers(str, &v, 1) || v < 0. || v > 1e7 || v != (int)v)
+        return (False);
+    *count = (int)v;
+    return (True);
+}
+
+/* Parse the key=value arguments of a layer */
+static
+Bool parse_layer(SceneLayer *l, char *args, const char *path, int lineno)
+{
+    char *key, *value;
+
+    for (key = strtok(args, " \t"); key; key = strtok(NULL, " \t")) {
+        Bool ok;
+
+        value = strchr(key, '=');
+        if (value == NULL) {
+            scene_error(path, lineno, "Expected key=value, got", key);
+            return (False);
+        }
+        *value++ = '\0';
+
+        if (!strcmp(key, "count"))
+            ok = parse_count(value, &l->count);
+        else if (!strcmp(key, "radius") && l->type == LAYER_RINGS)
+            ok = parse_numbers(value, &l->radius, 1) && l->radius >= 0.;
+        else if (!strcmp(key, "step") && l->type == LAYER_RINGS)
+            ok = parse_numbers(value, &l->step, 1);
+        else if (!strcmp(key, "radii") && l->type == LAYER_SPOKES)
+            ok = parse_numbers(value, l->ratio, SPOKE_POINTS);
+        else if (!strcmp(key, "phase") && l->type == LAYER_SPOKES)
+            ok = parse_numbers(value, l->phase, SPOKE_POINTS);
+        else if (!strcmp(key, "speed") && l->type == LAYER_SPOKES)
+            ok = parse_numbers(value, &l->speed, 1);
+        else {
+            scene_error(path, lineno, "Unknown layer parameter", key);
+            return (False);
+        }
+        if (!ok) {
+            scene_error(path, lineno, "Bad value for", key);
+            return (False);
+        }
+    }
+    return (True);
+}
+
+static
+Bool parse_line(Scene *s, char *line, const char *path, int lineno,
+                int spokes)
+{
+    SceneLayer  layer, *layers;
+    char       *p, *word, *arg;
+    double      v;
+    int         color, i;
+
+    if ((p = strchr(line, '#')) != NULL)
+        *p = '\0';
+    word = strtok(line, " \t\r\n");
+    if (word == NULL)
+        return (True);
+    arg = strtok(NULL, " \t\r\n");
+    if (arg == NULL) {
+        scene_error(path, lineno, "Missing argument to", word);
+        return (False);
+    }
+
+    if (!strcmp(word, "background")) {
+        free(s->colors[0]);
+        s->colors[0] = copy_string(arg);
+        return (True);
+    }
+    if (!strcmp(word, "linewidth")) {
+        if (!parse_numbers(arg, &v, 1) || v < 0. || v > MAX_LINE_WIDTH) {
+            scene_error(path, lineno, "Bad line width", arg);
+            return (False);
+        }
+        s->line_width = (int)v;
+        return (True);
+    }
+
+    memset(&layer, 0, sizeof(layer));
+    if (!strcmp(word, "rings")) {
+        layer.type   = LAYER_RINGS;
+        layer.count  = 7;
+        layer.radius = 50.;
+        layer.step   = 30.;
+    }
+    else if (!strcmp(word, "spokes")) {
+        layer.type  = LAYER_SPOKES;
+        layer.count = spokes;
+        layer.speed = 1.;
+        layer.ratio[0] = RATIO1;
+        layer.ratio[1] = RATIO2;
+        layer.ratio[2] = RATIO3;
+        for (i = 0; i < SPOKE_POINTS; i++)
+            layer.phase[i] = i * 0.1;
+    }
+    else {
+        scene_error(path, lineno, "Unknown directive", word);
+        return (False);
+    }
+
+    color = intern_color(s, arg);
+    if (color < 0) {
+        scene_error(path, lineno, "Too many colors at", arg);
+        return (False);
+    }
+    layer.color = color;
+
+    /* The rest of the line holds the parameters */
+    if (!parse_layer(&layer, strtok(NULL, "\r\n"), path, lineno))
+        return (False);
+
+    layers = realloc(s->layers, (s->nlayers + 1) * sizeof(SceneLayer));
+    if (layers == NULL) {
+        fprintf(stderr, "%s: Out of memory\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+    s->layers = layers;
+    s->layers[s->nlayers++] = layer;
+    return (True);
+}
+
+static
+void scene_init(Scene *s)
+{
+    memset(s, 0, sizeof(*s));
+    s->colors[0]  = copy_string("black");
+    s->ncolors    = 1;
+    s->line_width = LINE_WIDTH;
+}
+
+/* The built-in scene with |spokes| spokes */
+void scene_default(Scene *s, int spokes)
+{
+    char line[SCENE_LINE];
+    int  i;
+
+    scene_init(s);
+    for (i = 0; default_scene[i] != NULL; i++) {
+        strcpy(line, default_scene[i]);
+        parse_line(s, line, "built-in scene", i + 1, spokes);
+    }
+}
+
+/*
+ * Read the scene in |path|; |spokes| is the spoke count of layers that
+ * do not give one.  Returns False with a message on stderr if the file
+ * cannot be read or has errors.
+ */
+Bool scene_load(Scene *s, const char *path, int spokes)
+{
+    FILE *fp;
+    char  line[SCENE_LINE];
+    int   lineno = 0;
+    Bool  ok = True;
+
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: Cannot open scene %s\n", ProgramName, path);
+        return (False);
+    }
+
+    scene_init(s);
+    while (ok && fgets(line, sizeof(line), fp) != NULL) {
+        lineno++;
+        ok = parse_line(s, line, path, lineno, spokes);
+    }
+    fclose(fp);
+
+    if (ok && s->nlayers == 0) {
+        fprintf(stderr, "%s: %s: Scene has no layers\n", ProgramName, path);
+        ok = False;
+    }
+    if (!ok)
+        scene_free(s);
+    return (ok);
+}
+
+/* Give every spoke layer of |s| |spokes| spokes, e.g. from -control; the
+ * SpokeGeometry of a window rebuilds its tables on the next frame */
+void scene_set_spokes(Scene *s, int spokes)
+{
+    int i;
+
+    for (i = 0; i < s->nlayers; i++) {
+        if (s->layers[i].type == LAYER_SPOKES)
+            s->layers[i].count = spokes;
+    }
+}
+
+void scene_free(Scene *s)
+{
+    int i;
+
+    for (i = 0; i < s->ncolors; i++)
+        free(s->colors[i]);
+    free(s->layers);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Compile |s| for one window; |merge| enables spoke merging */
+void scene_lists_init(SceneLists *sl, const Scene *s, Bool merge)
+{
+    int i, k;
+
+    memset(sl, 0, sizeof(*sl));
+    sl->scene = s;
+    sl->rings.line_width = s->line_width;
+    sl->spokes = calloc(s->nlayers, sizeof(SpokeGeometry));
+    if (sl->spokes == NULL && s->nlayers > 0) {
+        fprintf(stderr, "%s: Out of memory\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < s->nlayers; i++) {
+        const SceneLayer *l = &s->layers[i];
+
+        if (l->type == LAYER_RINGS) {
+            for (k = 0; k < l->count; k++) {
+                int r = (int) (l->radius + k * l->step);
+
+                if (r >= 0)
+                    draw_list_add_arc(&sl->rings, l->color,
+                                      -r, -r, 2 * r, 2 * r);
+            }
+        }
+        else {
+            spoke_geometry_init(&sl->spokes[i]);
+            sl->spokes[i].merge = merge;
+            for (k = 0; k < SPOKE_POINTS; k++) {
+                sl->spokes[i].ratio[k] = l->ratio[k];
+                sl->spokes[i].lag[k]   = l->phase[k];
+            }
+        }
+    }
+}
+
+void scene_lists_free(SceneLists *sl)
+{
+    int i;
+
+    draw_list_free(&sl->rings);
+    if (sl->spokes != NULL) {
+        for (i = 0; i < sl->scene->nlayers; i++)
+            spoke_geometry_free(&sl->spokes[i]);
+        free(sl->spokes);
+    }
+    memset(sl, 0, sizeof(*sl));
+}
+
+/* Add the rings centered at (x, y); with |step| greater than 1 only
+ * every step-th ring of each color */
+void scene_add_rings(DrawList *dl, const SceneLists *sl, int x, int y,
+                     int step)
+{
+    int i, n, count;
+
+    for (i = 0; i < sl->rings.norder; i++) {
+        int              color = sl->rings.order[i];
+        const PrimBatch *b     = &sl->rings.batch[color];
+        XArc            *a;
+
+        count = (b->narcs + step - 1) / step;
+        a = draw_list_reserve_arcs(dl, color, count);
+        for (n = 0; n < count; n++) {
+            a[n] = b->arcs[n * step];
+            a[n].x += x;
+            a[n].y += y;
+        }
+    }
+}
+
+/* Add the spokes of all layers for |rotation| around (cx, cy), thinned
+ * out by |lod| unless it is NULL */
+static
+void scene_add_spokes(DrawList *dl, SceneLists *sl, const LodGovernor *lod,
+                      double rotation, int cx, int cy)
+{
+    const Scene *s = sl->scene;
+    int          i, count;
+
+    for (i = 0; i < s->nlayers; i++) {
+        const SceneLayer *l = &s->layers[i];
+
+        if (l->type != LAYER_SPOKES)
+            continue;
+        count = l->count;
+        if (lod)
+            count = lod_spokes(lod, count,
+                               spoke_rim(l->ratio[SPOKE_POINTS - 1], cx, cy),
+                               s->line_width);
+        spoke_geometry_update(&sl->spokes[i], count, rotation * l->speed,
+                              cx, cy);
+        spoke_geometry_emit(&sl->spokes[i], dl, l->color);
+    }
+}
+
+/*
+ * Build the primitives of one frame of a |width| x |height| window at
+ * |rotation| into |dl|.  This is all the CPU work of a frame and needs
+ * no server, so -cpubench can time it against a DrawList as a null
+ * sink.  The rings are left out unless |with_rings|, e.g. when they
+ * come from the ring cache; |cull| drops those off the window.  |lod|
+ * may be NULL for full detail.
+ */
+void scene_build_frame(DrawList *dl, SceneLists *sl, const LodGovernor *lod,
+                       double rotation, int width, int height,
+                       Bool with_rings, Bool cull)
+{
+    draw_list_reset(dl);
+
+    if (with_rings) {
+        scene_add_rings(dl, sl,
+                        width  / 2 + (int) (sin(rotation * 2) * RING_WOBBLE),
+                        height / 2 + (int) (cos(rotation * 2) * RING_WOBBLE),
+                        lod ? lod_ring_step(lod) : 1);
+        if (cull) {
+            XRectangle view = { 0, 0, width, height };
+
+            draw_list_cull_arcs(dl, &view, dl->line_width);
+        }
+    }
+
+    scene_add_spokes(dl, sl, lod, rotation, width / 2, height / 2);
+}
@@ -0,0 +1,184 @@
+/*
+ * xdbedizzy - per-frame protocol statistics (-stats)
+ *
+ * Every frame records how many X requests it issued (from NextRequest()),
+ * an estimate of the bytes of its drawing requests alone, the time spent
+ * building and issuing it, and the time XFlush() took to write it to
+ * the socket.  Every |sync_interval| frames an XSync() round trip is
+ * timed as well, which measures how far the server lags behind.
+ *
+ * The records go into a ring buffer allocated up front, so recording
+ * does neither allocate nor print while the animation runs; the ring
+ * is written out as CSV or JSON at exit or on SIGUSR1.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "xdbedizzy.h"
+
+Bool frame_stats_init(FrameStats *fs, int size, int sync_interval)
+{
+    memset(fs, 0, sizeof(*fs));
+    fs->ring = calloc(size, sizeof(FrameStat));
+    if (fs->ring == NULL)
+        return (False);
+    fs->size          = size;
+    fs->sync_interval = sync_interval;
+    fs->epoch         = dizzy_now_ns();
+    pthread_mutex_init(&fs->lock, NULL);
+    return (True);
+}
+
+void frame_stats_free(FrameStats *fs)
+{
+    if (fs->ring == NULL)
+        return;
+    free(fs->ring);
+    pthread_mutex_destroy(&fs->lock);
+    memset(fs, 0, sizeof(*fs));
+}
+
+/* Start recording a frame; does nothing if |fs| is not enabled */
+void frame_stats_begin(FrameStats *fs, Display *dpy)
+{
+    if (fs->ring == NULL)
+        return;
+    fs->t0      = dizzy_now_ns();
+    fs->request = NextRequest(dpy);
+}
+
+/*
+ * Flush the output buffer of the frame started by frame_stats_begin()
+ * and take its draw and flush times and request count.  Always flushes,
+ * whether |fs| is enabled or not.
+ */
+void frame_stats_flush(FrameStats *fs, Display *dpy)
+{
+    if (fs->ring == NULL) {
+        XFlush(dpy);
+        return;
+    }
+    fs->t1 = dizzy_now_ns();
+    XFlush(dpy);
+    fs->t2       = dizzy_now_ns();
+    fs->requests = NextRequest(dpy) - fs->request;
+    fs->flushed  = True;
+}
+
+/*
+ * Record the frame started by frame_stats_begin(), flushing it first
+ * unless frame_stats_flush() already did.  |dl| is the draw list that
+ * was sent, NULL if the frame was not drawn with the core protocol.
+ * The byte estimate and the periodic XSync() happen here, so callers
+ * timing the frame themselves can flush within their timing and record
+ * outside of it.
+ */
+void frame_stats_end(FrameStats *fs, Display *dpy, const DrawList *dl)
+{
+    FrameStat *s;
+    int64_t    t3;
+
+    if (!fs->flushed)
+        frame_stats_flush(fs, dpy);
+    if (fs->ring == NULL)
+        return;
+    fs->flushed = False;
+
+    pthread_mutex_lock(&fs->lock);
+    s = &fs->ring[fs->count % fs->size];
+    s->frame      = fs->count;
+    s->time       = fs->t0 - fs->epoch;
+    s->draw       = fs->t1 - fs->t0;
+    s->flush      = fs->t2 - fs->t1;
+    s->requests   = fs->requests;
+    s->draw_bytes = dl ? draw_list_request_bytes(dpy, dl) : 0;
+    s->sync       = -1;
+    fs->count++;
+    pthread_mutex_unlock(&fs->lock);
+
+    if (fs->sync_interval > 0 && s->frame % fs->sync_interval == 0) {
+        int64_t t2 = dizzy_now_ns();
+
+        XSync(dpy, False);
+        t3 = dizzy_now_ns();
+        pthread_mutex_lock(&fs->lock);
+        /* Still the same record unless the ring is tiny */
+        if (s->frame == fs->count - 1)
+            s->sync = t3 - t2;
+        pthread_mutex_unlock(&fs->lock);
+    }
+}
+
+static
+void write_record(FILE *fp, int format, int window, const FrameStat *s,
+                  Bool first)
+{
+    if (format == STATS_JSON) {
+        fprintf(fp, "%s\n    {\"window\": %d, \"frame\": %lu, "
+                "\"time_ns\": %lld, \"draw_ns\": %lld, \"flush_ns\": %lld, "
+                "\"sync_ns\": %lld, \"requests\": %lu, \"draw_bytes_est\": %lu}",
+                first ? "" : ",", window, s->frame,
+                (long long)s->time, (long long)s->draw, (long long)s->flush,
+                (long long)s->sync, s->requests, s->draw_bytes);
+    }
+    else {
+        fprintf(fp, "%d,%lu,%lld,%lld,%lld,%lld,%lu,%lu\n",
+                window, s->frame,
+                (long long)s->time, (long long)s->draw, (long long)s->flush,
+                (long long)s->sync, s->requests, s->draw_bytes);
+    }
+}
+
+/*
+ * Write the frames recorded in the |n| rings of |stats|, oldest first,
+ * to |path|; the index into |stats| is written as the window number.
+ * Returns False if the file could not be written.
+ */
+Bool frame_stats_dump(const char *path, int format, FrameStats **stats, int n)
+{
+    FILE         *fp;
+    Bool          first = True;
+    unsigned long i, begin;
+    int           w;
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: Cannot write statistics to %s\n",
+                ProgramName, path);
+        return (False);
+    }
+
+    if (format == STATS_JSON)
+        fprintf(fp, "{\"frames\": [");
+    else
+        fprintf(fp, "window,frame,time_ns,draw_ns,flush_ns,sync_ns,requests,draw_bytes_est\n");
+
+    for (w = 0; w < n; w++) {
+        FrameStats *fs = stats[w];
+
+        if (fs->ring == NULL)
+            continue;
+        pthread_mutex_lock(&fs->lock);
+        begin = (fs->count > (unsigned long)fs->size) ? fs->count - fs->size : 0;
+        for (i = begin; i < fs->count; i++) {
+            write_record(fp, format, w, &fs->ring[i % fs->size], first);
+            first = False;
+        }
+        pthread_mutex_unlock(&fs->lock);
+    }
+
+    if (format == STATS_JSON)
+        fprintf(fp, "\n]}\n");
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "%s: Cannot write statistics to %s\n",
+                ProgramName, path);
+        return (False);
+    }
+    return (True);
+}
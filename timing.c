@@ -0,0 +1,211 @@
+/*
+ * xdbedizzy - frame timing
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "xdbedizzy.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+/* Never try to catch up more than one second worth of frames, e.g.
+ * after the process was stopped or the server stalled */
+#define MAX_CATCHUP_NS NSEC_PER_SEC
+
+int64_t dizzy_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec);
+}
+
+void frame_clock_init(FrameClock *clk, double fps, Bool catchup)
+{
+    clk->period  = (fps > 0.) ? (int64_t)(NSEC_PER_SEC / fps) : 0;
+    clk->catchup = catchup;
+    clk->ticks   = 0;
+    clk->frames  = 0;
+    clk->late    = 0;
+    clk->skipped = 0;
+    frame_clock_reset(clk);
+}
+
+/* Forget the previous frame, e.g. after a pause.  The next frame is due
+ * immediately and does not account for the time spent paused. */
+void frame_clock_reset(FrameClock *clk)
+{
+    clk->next = 0;
+    clk->last = 0;
+}
+
+/* Change the frame rate, keeping the counters; the next frame is due
+ * immediately */
+void frame_clock_set_rate(FrameClock *clk, double fps)
+{
+    clk->period = (fps > 0.) ? (int64_t)(NSEC_PER_SEC / fps) : 0;
+    frame_clock_reset(clk);
+}
+
+/* Nanoseconds left until the next frame is due, <= 0 if it is due now */
+int64_t frame_clock_timeout(const FrameClock *clk, int64_t now)
+{
+    if (clk->period == 0 || clk->next == 0)
+        return (0);
+    return (clk->next - now);
+}
+
+/* Start a frame at |now| and schedule the next deadline.  Returns the
+ * time elapsed since the previous frame in units of the frame period,
+ * which callers use to advance the animation independently of the
+ * number of frames actually rendered.  Callers count the frames they
+ * render in |clk->frames|, a frame may still be dropped after this. */
+double frame_clock_tick(FrameClock *clk, int64_t now)
+{
+    double elapsed;
+
+    if (clk->last == 0 || clk->period == 0)
+        elapsed = 1.0;
+    else
+        elapsed = (double)(now - clk->last) / (double)clk->period;
+    clk->last = now;
+    clk->ticks++;
+
+    if (clk->period == 0)
+        return (elapsed);
+
+    if (clk->next == 0) {
+        clk->next = now + clk->period;
+        return (elapsed);
+    }
+
+    if (now > clk->next)
+        clk->late++;
+    clk->next += clk->period;
+
+    /* More than a full frame behind schedule: either keep the deadline
+     * grid and render the missed frames back to back (catch up), or
+     * drop the missed deadlines (skip) */
+    if (now >= clk->next &&
+        !(clk->catchup && now - clk->next < MAX_CATCHUP_NS)) {
+        int64_t missed = (now - clk->next) / clk->period + 1;
+
+        clk->next    += missed * clk->period;
+        clk->skipped += missed;
+    }
+    return (elapsed);
+}
+
+Bool frame_times_init(FrameTimes *ft, int size)
+{
+    memset(ft, 0, sizeof(*ft));
+    ft->total = calloc(4 * (size_t)size, sizeof(int64_t));
+    if (ft->total == NULL)
+        return (False);
+    ft->draw = ft->total + size;
+    ft->swap = ft->draw  + size;
+    ft->wait = ft->swap  + size;
+    ft->size = size;
+    return (True);
+}
+
+void frame_times_free(FrameTimes *ft)
+{
+    free(ft->total);
+    memset(ft, 0, sizeof(*ft));
+}
+
+void frame_times_add(FrameTimes *ft, int64_t draw, int64_t swap, int64_t wait)
+{
+    if (ft->count >= ft->size)
+        return;
+    ft->total[ft->count] = draw + swap + wait;
+    ft->draw[ft->count]  = draw;
+    ft->swap[ft->count]  = swap;
+    ft->wait[ft->count]  = wait;
+    ft->count++;
+}
+
+static
+int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return ((x > y) - (x < y));
+}
+
+/* Sort |count| samples in ns for samples_percentile_ms() */
+void samples_sort(int64_t *v, int count)
+{
+    qsort(v, count, sizeof(int64_t), compare_int64);
+}
+
+/* Nearest-rank percentile of an already sorted array */
+double samples_percentile_ms(const int64_t *sorted, int count, int pct)
+{
+    int rank = (count * pct + 99) / 100;
+
+    if (rank < 1)
+        rank = 1;
+    return (sorted[rank - 1] / 1e6);
+}
+
+static
+double sum_ms(const int64_t *v, int count)
+{
+    int64_t sum = 0;
+    int     i;
+
+    for (i = 0; i < count; i++)
+        sum += v[i];
+    return (sum / 1e6);
+}
+
+void frame_times_report(FILE *fp, const char *prefix, const FrameTimes *ft)
+{
+    int64_t *sorted;
+    double   seconds, total, draw, swap, wait;
+    int      n = ft->count;
+
+    if (n == 0) {
+        fprintf(fp, "%s: no frames rendered\n", prefix);
+        return;
+    }
+
+    sorted = malloc(n * sizeof(int64_t));
+    if (sorted == NULL)
+        return;
+    memcpy(sorted, ft->total, n * sizeof(int64_t));
+    samples_sort(sorted, n);
+
+    seconds = (ft->end - ft->begin) / 1e9;
+    total   = sum_ms(ft->total, n);
+    draw    = sum_ms(ft->draw,  n);
+    swap    = sum_ms(ft->swap,  n);
+    wait    = sum_ms(ft->wait,  n);
+    if (total <= 0.)
+        total = 1e-9;
+
+    fprintf(fp, "%s: %d frames in %.3f s, %.1f frames/s\n",
+            prefix, n, seconds, (seconds > 0.) ? n / seconds : 0.);
+    fprintf(fp, "%s: frame time ms: p50 %.3f p95 %.3f p99 %.3f max %.3f\n",
+            prefix,
+            samples_percentile_ms(sorted, n, 50),
+            samples_percentile_ms(sorted, n, 95),
+            samples_percentile_ms(sorted, n, 99), sorted[n - 1] / 1e6);
+    fprintf(fp, "%s: per frame ms: draw %.3f (%.1f%%) swap %.3f (%.1f%%) "
+            "server %.3f (%.1f%%)\n",
+            prefix,
+            draw / n, 100. * draw / total,
+            swap / n, 100. * swap / total,
+            wait / n, 100. * wait / total);
+    free(sorted);
+}
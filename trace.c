@@ -0,0 +1,354 @@
+/*
+ * xdbedizzy - primitive trace (-record, -replay)
+ *
+ * -record writes the primitives of every frame to a file, and -replay
+ * sends them to a server again without building any scene, so what is
+ * measured is the server and the protocol, and the same workload can be
+ * sent to different servers.
+ *
+ * The file starts with a TraceHeader: the palette and line width of the
+ * scene, so that replaying needs neither the -scene file nor the
+ * options of the recording.  A sequence of records follows, each a
+ * TraceRecord and its data:
+ *
+ *     TRACE_FRAME     the time of the frame in ns since the first one
+ *                     and the window size, see TraceFrame
+ *     TRACE_ARCS      |count| XArc structures drawn with GC |color|
+ *     TRACE_SEGMENTS  |count| XSegment structures drawn with GC |color|
+ *     TRACE_SWAP      the end of the frame
+ *
+ * The structures are written as they are in memory, so the replay can
+ * hand them to Xlib straight from the mapped file; in turn a trace can
+ * only be replayed on a machine of the byte order it was recorded on.
+ * The records are a multiple of 4 bytes long.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xdbedizzy.h"
+
+#define TRACE_MAGIC "XDBETRC1"
+#define TRACE_ORDER 0x01020304
+#define TRACE_NAME  64          /* bytes per color name, NUL included */
+#define TRACE_BUFFER (1 << 20)
+
+enum {
+    TRACE_FRAME = 1,
+    TRACE_ARCS,
+    TRACE_SEGMENTS,
+    TRACE_SWAP
+};
+
+typedef struct {
+    char     magic[8];
+    uint32_t order;             /* TRACE_ORDER as the writer stores it */
+    int32_t  line_width;
+    int32_t  ncolors;
+    int32_t  reserved;
+    char     colors[MAX_COLORS][TRACE_NAME];
+} TraceHeader;
+
+typedef struct {
+    uint16_t type;
+    uint16_t color;
+    uint32_t count;             /* primitives that follow */
+} TraceRecord;
+
+typedef struct {
+    int64_t  time;
+    int32_t  width, height;
+} TraceFrame;
+
+/* Recording */
+static FILE          *rec_fp;
+static const char    *rec_path;
+static int64_t        rec_epoch;
+static Bool           rec_failed;
+
+/* Replaying */
+static unsigned char *rep_map;
+static size_t         rep_size;
+static size_t         rep_pos;      /* of the next record */
+static size_t         rep_end;      /* end of the last complete frame */
+
+static
+void write_record(int type, int color, uint32_t count, const void *data,
+                  size_t size)
+{
+    TraceRecord r;
+
+    memset(&r, 0, sizeof(r));
+    r.type  = type;
+    r.color = color;
+    r.count = count;
+    if (fwrite(&r, sizeof(r), 1, rec_fp) != 1 ||
+        (size > 0 && fwrite(data, size, 1, rec_fp) != 1))
+        rec_failed = True;
+}
+
+/*
+ * Create the trace |path| for frames of |scene|.  Returns False with a
+ * message on stderr if it cannot be written.
+ */
+Bool trace_record_open(const char *path, const Scene *scene)
+{
+    TraceHeader h;
+    int         i;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+    h.order      = TRACE_ORDER;
+    h.line_width = scene->line_width;
+    h.ncolors    = scene->ncolors;
+    for (i = 0; i < scene->ncolors; i++) {
+        if (strlen(scene->colors[i]) >= TRACE_NAME) {
+            fprintf(stderr, "%s: Color name too long for a trace: %s\n",
+                    ProgramName, scene->colors[i]);
+            return (False);
+        }
+        strcpy(h.colors[i], scene->colors[i]);
+    }
+
+    rec_fp = fopen(path, "wb");
+    if (rec_fp == NULL) {
+        fprintf(stderr, "%s: Cannot create %s: %s\n", ProgramName, path,
+                strerror(errno));
+        return (False);
+    }
+    /* Writing a frame should rarely reach the file system */
+    setvbuf(rec_fp, NULL, _IOFBF, TRACE_BUFFER);
+    rec_path   = path;
+    rec_epoch  = 0;
+    rec_failed = (fwrite(&h, sizeof(h), 1, rec_fp) != 1);
+    return (True);
+}
+
+/* Append the frame |dl|, drawn into a |width| x |height| window and
+ * started at |time| */
+void trace_record_frame(const DrawList *dl, int width, int height,
+                        int64_t time)
+{
+    TraceFrame f;
+    int        i;
+
+    if (rec_fp == NULL || rec_failed)
+        return;
+    if (rec_epoch == 0)
+        rec_epoch = time;
+
+    memset(&f, 0, sizeof(f));
+    f.time   = time - rec_epoch;
+    f.width  = width;
+    f.height = height;
+    write_record(TRACE_FRAME, 0, 0, &f, sizeof(f));
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b = &dl->batch[dl->order[i]];
+
+        if (b->narcs > 0)
+            write_record(TRACE_ARCS, dl->order[i], b->narcs, b->arcs,
+                         b->narcs * sizeof(XArc));
+        if (b->nsegs > 0)
+            write_record(TRACE_SEGMENTS, dl->order[i], b->nsegs, b->segs,
+                         b->nsegs * sizeof(XSegment));
+    }
+    write_record(TRACE_SWAP, 0, 0, NULL, 0);
+}
+
+void trace_record_close(void)
+{
+    if (rec_fp == NULL)
+        return;
+    if (fclose(rec_fp) != 0)
+        rec_failed = True;
+    if (rec_failed)
+        fprintf(stderr, "%s: Error writing %s, the trace is incomplete.\n",
+                ProgramName, rec_path);
+    rec_fp = NULL;
+}
+
+/* The record at |pos| if it and its data are inside the file, with the
+ * position after it in |*next|; NULL otherwise */
+static
+const TraceRecord *record_at(size_t pos, int ncolors, size_t *next)
+{
+    const TraceRecord *r;
+    size_t             size;
+
+    if (rep_size - pos < sizeof(TraceRecord))
+        return (NULL);
+    r = (const TraceRecord *) (rep_map + pos);
+    switch (r->type) {
+    case TRACE_FRAME:
+        size = sizeof(TraceFrame);
+        break;
+    case TRACE_ARCS:
+        size = (size_t) r->count * sizeof(XArc);
+        break;
+    case TRACE_SEGMENTS:
+        size = (size_t) r->count * sizeof(XSegment);
+        break;
+    case TRACE_SWAP:
+        size = 0;
+        break;
+    default:
+        return (NULL);
+    }
+    if (r->color >= ncolors ||
+        rep_size - pos - sizeof(TraceRecord) < size)
+        return (NULL);
+    *next = pos + sizeof(TraceRecord) + size;
+    return (r);
+}
+
+/*
+ * Map the trace |path| and replace |scene| with its palette.  The number
+ * of complete frames in it and the size of the first one are stored in
+ * |*frames|, |*width| and |*height|.  Returns False with a message on
+ * stderr if the file cannot be read or is not a trace.
+ */
+Bool trace_replay_open(const char *path, Scene *scene, int *frames,
+                       int *width, int *height)
+{
+    const TraceHeader *h;
+    struct stat        st;
+    size_t             pos, next;
+    Bool               in_frame = False;
+    int                fd, i;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "%s: Cannot open %s: %s\n", ProgramName, path,
+                strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return (False);
+    }
+    rep_size = st.st_size;
+    rep_map  = (rep_size >= sizeof(TraceHeader))
+        ? mmap(NULL, rep_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    h = (const TraceHeader *) rep_map;
+    if (rep_map == MAP_FAILED ||
+        memcmp(h->magic, TRACE_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "%s: %s is not a trace.\n", ProgramName, path);
+        if (rep_map != MAP_FAILED)
+            munmap(rep_map, rep_size);
+        rep_map = NULL;
+        return (False);
+    }
+    if (h->order != TRACE_ORDER || h->ncolors < 1 ||
+        h->ncolors > MAX_COLORS) {
+        fprintf(stderr, "%s: %s was recorded with another byte order "
+                "or is damaged.\n", ProgramName, path);
+        trace_replay_close();
+        return (False);
+    }
+
+    /* Check every record now, so that replaying can trust them */
+    *frames = 0;
+    rep_end = sizeof(TraceHeader);
+    for (pos = sizeof(TraceHeader); pos < rep_size; pos = next) {
+        const TraceRecord *r = record_at(pos, h->ncolors, &next);
+
+        if (r == NULL || (r->type == TRACE_FRAME) == in_frame)
+            break;
+        if (r->type == TRACE_FRAME) {
+            if (*frames == 0) {
+                TraceFrame f;
+
+                memcpy(&f, r + 1, sizeof(f));
+                *width  = f.width;
+                *height = f.height;
+            }
+            in_frame = True;
+        }
+        else if (r->type == TRACE_SWAP) {
+            in_frame = False;
+            rep_end  = next;
+            (*frames)++;
+        }
+    }
+    if (rep_end < rep_size)
+        Log(("Ignoring the incomplete end of %s.\n", path));
+    if (*frames == 0) {
+        fprintf(stderr, "%s: %s has no complete frame.\n", ProgramName, path);
+        trace_replay_close();
+        return (False);
+    }
+
+    scene_free(scene);
+    for (i = 0; i < h->ncolors; i++) {
+        char name[TRACE_NAME];
+
+        memcpy(name, h->colors[i], TRACE_NAME);
+        name[TRACE_NAME - 1] = '\0';
+        scene->colors[i] = strdup(name);
+        if (scene->colors[i] == NULL) {
+            fprintf(stderr, "%s: Out of memory\n", ProgramName);
+            exit(EXIT_FAILURE);
+        }
+    }
+    scene->ncolors    = h->ncolors;
+    scene->line_width = h->line_width;
+    rep_pos = sizeof(TraceHeader);
+    return (True);
+}
+
+/* Move on to the next frame and get its time and window size; returns
+ * False after the last one */
+Bool trace_replay_next(int64_t *time, int *width, int *height)
+{
+    TraceFrame f;
+
+    if (rep_pos >= rep_end)
+        return (False);
+    /* Records are only 4 byte aligned */
+    memcpy(&f, rep_map + rep_pos + sizeof(TraceRecord), sizeof(f));
+    *time   = f.time;
+    *width  = f.width;
+    *height = f.height;
+    rep_pos += sizeof(TraceRecord) + sizeof(TraceFrame);
+    return (True);
+}
+
+/* Send the primitives of the frame to |d|, straight from the mapping */
+void trace_replay_emit(Display *dpy, Drawable d, GC *gcs)
+{
+    const TraceRecord *r;
+
+    for (;;) {
+        r = (const TraceRecord *) (rep_map + rep_pos);
+        rep_pos += sizeof(TraceRecord);
+        if (r->type == TRACE_SWAP)
+            break;
+        if (r->type == TRACE_ARCS) {
+            draw_arcs(dpy, d, gcs[r->color], (const XArc *) (r + 1),
+                      r->count);
+            rep_pos += r->count * sizeof(XArc);
+        }
+        else {
+            draw_segments(dpy, d, gcs[r->color], (const XSegment *) (r + 1),
+                          r->count);
+            rep_pos += r->count * sizeof(XSegment);
+        }
+    }
+}
+
+void trace_replay_close(void)
+{
+    if (rep_map != NULL)
+        munmap(rep_map, rep_size);
+    rep_map = NULL;
+}
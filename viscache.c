@@ -0,0 +1,200 @@
+/*
+ * xdbedizzy - cache of the chosen double buffer visual
+ *
+ * Choosing the visual takes an XdbeGetVisualInfo() round trip.  Its
+ * result only changes with the server, so the visual chosen for a
+ * display, screen and set of -class, -depth and -visid options is kept
+ * in a small text file, one line per choice:
+ *
+ *     <display> <screen> <vendor release> <visuals> <class> <depth>
+ *         <visid> <chosen visual id> <chosen depth>
+ *
+ * The key includes the vendor release and the number of visuals of the
+ * screen, which are known from the connection setup, so a different
+ * server on the same display is not mistaken for the cached one.  A hit
+ * is only used if the visual still exists on the screen with the cached
+ * depth and class; otherwise the caller queries the server and the
+ * entry is replaced.  The newest entries are kept at the top.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <X11/Xutil.h>
+#include "xdbedizzy.h"
+
+#define CACHE_ENTRIES 32
+#define CACHE_LINE    512
+
+/* $XDG_CACHE_HOME/xdbedizzy-visuals or ~/.cache/xdbedizzy-visuals */
+static
+Bool cache_path(char *path, size_t size, Bool create_dir)
+{
+    const char *dir  = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int         n;
+
+    if (dir != NULL && dir[0] != '\0') {
+        n = snprintf(path, size, "%s/xdbedizzy-visuals", dir);
+    }
+    else if (home != NULL && home[0] != '\0') {
+        n = snprintf(path, size, "%s/.cache", home);
+        if (n > 0 && (size_t) n < size && create_dir)
+            mkdir(path, 0700);
+        n = snprintf(path, size, "%s/.cache/xdbedizzy-visuals", home);
+    }
+    else {
+        return (False);
+    }
+    return (n > 0 && (size_t) n < size);
+}
+
+/* The key of the choice: everything but the last two fields of a line */
+static
+void cache_key(char *key, size_t size, Display *dpy, int screen,
+               int visclass, int depth, VisualID visid)
+{
+    XVisualInfo  tmpl, *vis;
+    int          nvis = 0;
+    const char  *name = DisplayString(dpy);
+    char         display[256];
+    int          i;
+
+    tmpl.screen = screen;
+    vis = XGetVisualInfo(dpy, VisualScreenMask, &tmpl, &nvis);
+    if (vis != NULL)
+        XFree(vis);
+
+    /* Blanks separate the fields */
+    for (i = 0; name[i] != '\0' && i < (int) sizeof(display) - 1; i++)
+        display[i] = (name[i] == ' ') ? '_' : name[i];
+    display[i] = '\0';
+
+    snprintf(key, size, "%s %d %d %d %d %d %#lx", display, screen,
+             VendorRelease(dpy), nvis, visclass, depth,
+             (unsigned long) visid);
+}
+
+/* Split |line| into the key and the chosen visual; False if malformed */
+static
+Bool parse_entry(char *line, char **key, VisualID *id, int *depth)
+{
+    char          *p;
+    unsigned long  v;
+    int            d;
+
+    line[strcspn(line, "\n")] = '\0';
+    /* The last two fields are the result */
+    p = strrchr(line, ' ');
+    if (p == NULL || sscanf(p + 1, "%d", &d) != 1)
+        return (False);
+    *p = '\0';
+    p = strrchr(line, ' ');
+    if (p == NULL || sscanf(p + 1, "%lx", &v) != 1)
+        return (False);
+    *p = '\0';
+    *key   = line;
+    *id    = v;
+    *depth = d;
+    return (True);
+}
+
+/*
+ * The visual cached for the choice described by |visclass|, |depth| and
+ * |visid| on |screen| of |dpy|, NULL if there is none or it does not
+ * match the screen any more.  Stores its depth in |*pDepth|.
+ */
+Visual *visual_cache_lookup(Display *dpy, int screen, int visclass,
+                            int depth, VisualID visid, int *pDepth)
+{
+    char         path[1024], line[CACHE_LINE], key[CACHE_LINE];
+    char        *k;
+    FILE        *fp;
+    VisualID     id = 0;
+    int          d = 0;
+    Bool         found = False;
+    XVisualInfo  tmpl, *vis;
+    Visual      *visual = NULL;
+    int          nvis;
+
+    if (!cache_path(path, sizeof(path), False))
+        return (NULL);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return (NULL);
+    cache_key(key, sizeof(key), dpy, screen, visclass, depth, visid);
+    while (!found && fgets(line, sizeof(line), fp) != NULL) {
+        if (parse_entry(line, &k, &id, &d) && !strcmp(k, key))
+            found = True;
+    }
+    fclose(fp);
+    if (!found)
+        return (NULL);
+
+    /* The visual list comes with the connection setup, so this check
+     * costs no round trip */
+    tmpl.visualid = id;
+    tmpl.screen   = screen;
+    vis = XGetVisualInfo(dpy, VisualIDMask | VisualScreenMask, &tmpl, &nvis);
+    if (vis == NULL)
+        return (NULL);
+    if (vis->depth == d && (visid != 0 || vis->class == visclass) &&
+        (visid == 0 || vis->visualid == visid) &&
+        (depth == 0 || vis->depth == depth)) {
+        visual  = vis->visual;
+        *pDepth = d;
+    }
+    XFree(vis);
+    if (visual == NULL)
+        Log(("Cached visual %#lx does not match, ignoring it.\n",
+             (unsigned long) id));
+    return (visual);
+}
+
+/* Remember |visual| of |depth| as the choice for the given options; the
+ * cache is best effort, errors are ignored */
+void visual_cache_store(Display *dpy, int screen, int visclass, int depth,
+                        VisualID visid, const Visual *visual, int chosen)
+{
+    char      path[1024], tmp[1040], key[CACHE_LINE];
+    char      line[CACHE_LINE], copy[CACHE_LINE];
+    char     *k;
+    FILE     *in, *out;
+    VisualID  id;
+    int       d, n = 1;
+
+    if (!cache_path(path, sizeof(path), True))
+        return;
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+    out = fopen(tmp, "w");
+    if (out == NULL)
+        return;
+
+    cache_key(key, sizeof(key), dpy, screen, visclass, depth, visid);
+    fprintf(out, "%s %#lx %d\n", key, (unsigned long) visual->visualid,
+            chosen);
+
+    /* Keep the other entries, dropping the old one for this key */
+    in = fopen(path, "r");
+    if (in != NULL) {
+        while (n < CACHE_ENTRIES && fgets(line, sizeof(line), in) != NULL) {
+            strcpy(copy, line);
+            if (!parse_entry(line, &k, &id, &d) || !strcmp(k, key))
+                continue;
+            fputs(copy, out);
+            n++;
+        }
+        fclose(in);
+    }
+
+    /* Replace the file in one step, so no reader sees half of it */
+    if (fclose(out) != 0 || rename(tmp, path) != 0)
+        remove(tmp);
+}
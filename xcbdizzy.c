@@ -0,0 +1,578 @@
+/*
+ * xdbedizzy - native XCB backend
+ *
+ * Renders the same scene as the Xlib path over its own XCB connection.
+ * Startup avoids the serial round trips of the Xlib code: the color
+ * lookups and the DBE queries are all sent before the first reply is
+ * collected, and for TrueColor visuals the pixels are computed locally
+ * instead of being allocated.  Frames are sent with xcb_poly_arc and
+ * xcb_poly_segment and flushed exactly once per frame.
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/select.h>
+#include <xcb/xcb.h>
+#include <xcb/dbe.h>
+#include "xdbedizzy.h"
+
+typedef struct {
+    const DizzyOptions *opts;
+    xcb_connection_t   *c;
+    xcb_screen_t       *screen;
+    xcb_visualtype_t   *visual;
+    uint8_t             depth;
+    xcb_colormap_t      cmap;
+    xcb_window_t        win;
+    xcb_drawable_t      buf;
+    xcb_gcontext_t      gcs[MAX_COLORS];
+    uint32_t            pixels[MAX_COLORS];
+    xcb_pixmap_t        ring_pixmap;
+    uint16_t            width, height;
+    uint32_t            max_request;    /* in 4 byte units */
+    DrawList            drawlist;
+    SceneLists          scene;
+    double              rotation;
+    double              delta;
+    Bool                paused;
+    Bool                manual_paused;
+} XcbDizzy;
+
+/* Find the visual type and depth of |id| in the connection setup data;
+ * this needs no round trip */
+static
+xcb_visualtype_t *find_visual(xcb_screen_t *screen, xcb_visualid_t id,
+                              uint8_t *depth)
+{
+    xcb_depth_iterator_t di;
+
+    for (di = xcb_screen_allowed_depths_iterator(screen); di.rem;
+         xcb_depth_next(&di)) {
+        xcb_visualtype_iterator_t vi;
+
+        for (vi = xcb_depth_visuals_iterator(di.data); vi.rem;
+             xcb_visualtype_next(&vi)) {
+            if (vi.data->visual_id == id) {
+                *depth = di.data->depth;
+                return (vi.data);
+            }
+        }
+    }
+    return (NULL);
+}
+
+/* Same selection rules as choose_DB_visual() in xdbedizzy.c */
+static
+Bool choose_visual(XcbDizzy *xd, xcb_dbe_get_visual_info_reply_t *reply)
+{
+    const DizzyOptions             *o = xd->opts;
+    xcb_dbe_visual_infos_iterator_t it;
+    int                             chosen_depth = 0;
+    int                             i, n;
+
+    xd->visual = NULL;
+    it = xcb_dbe_get_visual_info_supported_visuals_iterator(reply);
+    if (it.rem == 0)
+        return (False);
+
+    /* We only asked about the root window of one screen */
+    n = xcb_dbe_visual_infos_infos_length(it.data);
+    for (i = 0; i < n; i++) {
+        xcb_dbe_visual_info_t *info = xcb_dbe_visual_infos_infos(it.data) + i;
+        xcb_visualtype_t      *vt;
+        uint8_t                d;
+
+        vt = find_visual(xd->screen, info->visual_id, &d);
+        if (vt == NULL)
+            continue;
+        if (o->visid) {
+            if (vt->visual_id == o->visid) {
+                xd->visual   = vt;
+                chosen_depth = d;
+            }
+        }
+        else if (vt->_class == o->visclass) {
+            if (o->depth == 0) {
+                /* Choose first deepest visual of matching class. */
+                if (info->depth > chosen_depth) {
+                    xd->visual   = vt;
+                    chosen_depth = d;
+                }
+            }
+            else if (info->depth == o->depth) {
+                /* Choose last visual of matching depth and class. */
+                xd->visual   = vt;
+                chosen_depth = d;
+            }
+        }
+    }
+    xd->depth = chosen_depth;
+    return (xd->visual != NULL);
+}
+
+static
+void fatal(const char *what)
+{
+    fprintf(stderr, "%s: xcb: %s\n", ProgramName, what);
+    exit(EXIT_FAILURE);
+}
+
+static
+void xcb_setup_window(XcbDizzy *xd)
+{
+    const DizzyOptions              *o = xd->opts;
+    const Scene                     *scene = o->scene;
+    xcb_lookup_color_cookie_t        lookup[MAX_COLORS];
+    xcb_lookup_color_reply_t        *color[MAX_COLORS];
+    xcb_alloc_color_cookie_t         alloc[MAX_COLORS];
+    xcb_dbe_query_version_cookie_t   version_cookie;
+    xcb_dbe_get_visual_info_cookie_t visinfo_cookie;
+    xcb_dbe_query_version_reply_t   *version;
+    xcb_dbe_get_visual_info_reply_t *visinfo;
+    xcb_drawable_t                   root;
+    uint32_t                         attrs[4];
+    int                              i;
+
+    root = xd->screen->root;
+    if (o->do_db)
+        xcb_prefetch_extension_data(xd->c, &xcb_dbe_id);
+    xcb_prefetch_maximum_request_length(xd->c);
+
+    /* Round one: everything that does not depend on another reply */
+    for (i = 0; i < scene->ncolors; i++) {
+        lookup[i] = xcb_lookup_color(xd->c, xd->screen->default_colormap,
+                                     strlen(scene->colors[i]),
+                                     scene->colors[i]);
+    }
+    if (o->do_db) {
+        const xcb_query_extension_reply_t *ext;
+
+        ext = xcb_get_extension_data(xd->c, &xcb_dbe_id);
+        if (ext == NULL || !ext->present)
+            fatal("DOUBLE-BUFFER extension not available");
+        version_cookie = xcb_dbe_query_version(xd->c, 1, 0);
+        visinfo_cookie = xcb_dbe_get_visual_info(xd->c, 1, &root);
+
+        version = xcb_dbe_query_version_reply(xd->c, version_cookie, NULL);
+        if (version == NULL)
+            fatal("DbeQueryVersion failed");
+        free(version);
+
+        visinfo = xcb_dbe_get_visual_info_reply(xd->c, visinfo_cookie, NULL);
+        if (visinfo == NULL || !choose_visual(xd, visinfo))
+            fatal("no matching double buffer capable visual");
+        free(visinfo);
+        fprintf(stdout, "%s: Chose visual ID: %#4x depth: %d\n\n",
+                ProgramName, (int)xd->visual->visual_id, xd->depth);
+    }
+    else {
+        xd->visual = find_visual(xd->screen, xd->screen->root_visual,
+                                 &xd->depth);
+    }
+
+    for (i = 0; i < scene->ncolors; i++) {
+        color[i] = xcb_lookup_color_reply(xd->c, lookup[i], NULL);
+        if (color[i] == NULL) {
+            fprintf(stderr, "%s: Couldn't get color: %s\n",
+                    ProgramName, scene->colors[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Round two: the colors, unless they can be computed locally */
+    xd->cmap = xcb_generate_id(xd->c);
+    xcb_create_colormap(xd->c, XCB_COLORMAP_ALLOC_NONE, xd->cmap, root,
+                        xd->visual->visual_id);
+    if (xd->visual->_class == XCB_VISUAL_CLASS_TRUE_COLOR) {
+        for (i = 0; i < scene->ncolors; i++) {
+            XColor c;
+
+            c.red   = color[i]->exact_red;
+            c.green = color[i]->exact_green;
+            c.blue  = color[i]->exact_blue;
+            xd->pixels[i] = true_color_pixel(xd->visual->red_mask,
+                                             xd->visual->green_mask,
+                                             xd->visual->blue_mask, &c);
+        }
+    }
+    else {
+        for (i = 0; i < scene->ncolors; i++) {
+            alloc[i] = xcb_alloc_color(xd->c, xd->cmap,
+                                       color[i]->exact_red,
+                                       color[i]->exact_green,
+                                       color[i]->exact_blue);
+        }
+        for (i = 0; i < scene->ncolors; i++) {
+            xcb_alloc_color_reply_t *r;
+
+            r = xcb_alloc_color_reply(xd->c, alloc[i], NULL);
+            if (r == NULL) {
+                fprintf(stderr, "%s: Couldn't get color: %s\n",
+                        ProgramName, scene->colors[i]);
+                exit(EXIT_FAILURE);
+            }
+            xd->pixels[i] = r->pixel;
+            free(r);
+        }
+    }
+    for (i = 0; i < scene->ncolors; i++)
+        free(color[i]);
+
+    /* No more replies needed from here on */
+    xd->width  = 400;
+    xd->height = 400;
+    xd->win    = xcb_generate_id(xd->c);
+    /* in the bit order of the value mask */
+    attrs[0]   = xd->pixels[COLOR_BACKGROUND];
+    attrs[1]   = xd->pixels[COLOR_BACKGROUND];
+    attrs[2]   = XCB_EVENT_MASK_VISIBILITY_CHANGE | XCB_EVENT_MASK_EXPOSURE |
+                 XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_KEY_PRESS |
+                 XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+    attrs[3]   = xd->cmap;
+    xcb_create_window(xd->c, xd->depth, xd->win, root,
+                      10, 10, xd->width, xd->height, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, xd->visual->visual_id,
+                      XCB_CW_BACK_PIXEL | XCB_CW_BORDER_PIXEL |
+                      XCB_CW_EVENT_MASK | XCB_CW_COLORMAP, attrs);
+    xcb_change_property(xd->c, XCB_PROP_MODE_REPLACE, xd->win,
+                        XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+                        strlen("DBE dizzy demo"), "DBE dizzy demo");
+
+    if (o->do_db) {
+        xd->buf = xcb_generate_id(xd->c);
+        xcb_dbe_allocate_back_buffer(xd->c, xd->win, xd->buf, o->swap_action);
+    }
+    else {
+        xd->buf = xd->win;
+    }
+
+    for (i = 0; i < scene->ncolors; i++) {
+        uint32_t gcvals[3];
+
+        gcvals[0] = xd->pixels[i];
+        gcvals[1] = scene->line_width;
+        gcvals[2] = XCB_CAP_STYLE_ROUND;
+        xd->gcs[i] = xcb_generate_id(xd->c);
+        xcb_create_gc(xd->c, xd->gcs[i], xd->win,
+                      XCB_GC_FOREGROUND | XCB_GC_LINE_WIDTH | XCB_GC_CAP_STYLE,
+                      gcvals);
+    }
+
+    xd->max_request = xcb_get_maximum_request_length(xd->c);
+    xcb_map_window(xd->c, xd->win);
+    xcb_flush(xd->c);
+}
+
+static
+void xcb_emit_draw_list(XcbDizzy *xd, xcb_drawable_t d, const DrawList *dl)
+{
+    /* 3 units of request header plus a possible BIG-REQUESTS length */
+    int maxarcs = (xd->max_request - 4) / 3;
+    int maxsegs = (xd->max_request - 4) / 2;
+    int i, n, chunk;
+
+    for (i = 0; i < dl->norder; i++) {
+        const PrimBatch *b  = &dl->batch[dl->order[i]];
+        xcb_gcontext_t   gc = xd->gcs[dl->order[i]];
+
+        /* XArc and XSegment have the wire layout of xcb_arc_t and
+         * xcb_segment_t */
+        for (n = 0; n < b->narcs; n += chunk) {
+            chunk = b->narcs - n;
+            if (chunk > maxarcs)
+                chunk = maxarcs;
+            xcb_poly_arc(xd->c, d, gc, chunk,
+                         (const xcb_arc_t *)(b->arcs + n));
+        }
+        for (n = 0; n < b->nsegs; n += chunk) {
+            chunk = b->nsegs - n;
+            if (chunk > maxsegs)
+                chunk = maxsegs;
+            xcb_poly_segment(xd->c, d, gc, chunk,
+                             (const xcb_segment_t *)(b->segs + n));
+        }
+    }
+}
+
+static
+void xcb_update_ring_cache(XcbDizzy *xd)
+{
+    DrawList        rings;
+    xcb_rectangle_t r;
+    XRectangle      view;
+
+    if (xd->ring_pixmap != XCB_NONE)
+        return;
+
+    r.x      = 0;
+    r.y      = 0;
+    r.width  = xd->width  + 2 * RING_WOBBLE;
+    r.height = xd->height + 2 * RING_WOBBLE;
+    xd->ring_pixmap = xcb_generate_id(xd->c);
+    xcb_create_pixmap(xd->c, xd->depth, xd->ring_pixmap, xd->win,
+                      r.width, r.height);
+    xcb_poly_fill_rectangle(xd->c, xd->ring_pixmap, xd->gcs[COLOR_BACKGROUND],
+                            1, &r);
+
+    memset(&rings, 0, sizeof(rings));
+    rings.line_width = xd->opts->scene->line_width;
+    scene_add_rings(&rings, &xd->scene, xd->width / 2 + RING_WOBBLE,
+                    xd->height / 2 + RING_WOBBLE, 1);
+    if (xd->opts->cull) {
+        view.x      = 0;
+        view.y      = 0;
+        view.width  = r.width;
+        view.height = r.height;
+        draw_list_cull_arcs(&rings, &view, rings.line_width);
+    }
+    xcb_emit_draw_list(xd, xd->ring_pixmap, &rings);
+    draw_list_free(&rings);
+}
+
+static
+void xcb_draw_scene(XcbDizzy *xd)
+{
+    int ox = (int) (sin(xd->rotation * 2) * RING_WOBBLE);
+    int oy = (int) (cos(xd->rotation * 2) * RING_WOBBLE);
+
+    if (xd->opts->ring_cache) {
+        xcb_update_ring_cache(xd);
+        xcb_copy_area(xd->c, xd->ring_pixmap, xd->buf, xd->gcs[COLOR_BACKGROUND],
+                      RING_WOBBLE - ox, RING_WOBBLE - oy, 0, 0,
+                      xd->width, xd->height);
+    }
+    else {
+        if (!xd->opts->do_db) {
+            xcb_clear_area(xd->c, 0, xd->win, 0, 0, 0, 0);
+        }
+        else if (xd->opts->swap_action != XCB_DBE_SWAP_ACTION_BACKGROUND) {
+            xcb_rectangle_t r = { 0, 0, xd->width, xd->height };
+
+            xcb_poly_fill_rectangle(xd->c, xd->buf, xd->gcs[COLOR_BACKGROUND],
+                                    1, &r);
+        }
+    }
+    scene_build_frame(&xd->drawlist, &xd->scene, NULL, xd->rotation,
+                      xd->width, xd->height,
+                      !xd->opts->ring_cache, xd->opts->cull);
+    xcb_emit_draw_list(xd, xd->buf, &xd->drawlist);
+}
+
+static
+void xcb_swap_buffers(XcbDizzy *xd)
+{
+    if (xd->opts->do_db) {
+        xcb_dbe_swap_info_t info;
+
+        memset(&info, 0, sizeof(info));
+        info.window      = xd->win;
+        info.swap_action = xd->opts->swap_action;
+        xcb_dbe_swap_buffers(xd->c, 1, &info);
+    }
+}
+
+/* Round trip to the server, like XSync() */
+static
+void xcb_sync(XcbDizzy *xd)
+{
+    free(xcb_get_input_focus_reply(xd->c, xcb_get_input_focus(xd->c), NULL));
+}
+
+/* Wait for input on the connection for at most |ns| nanoseconds,
+ * forever if |ns| is negative */
+static
+void xcb_wait(XcbDizzy *xd, int64_t ns)
+{
+    fd_set         mask;
+    struct timeval timeout;
+    int            fd = xcb_get_file_descriptor(xd->c);
+
+    FD_ZERO(&mask);
+    FD_SET(fd, &mask);
+    if (ns >= 0) {
+        ns = (ns + 999) / 1000;
+        timeout.tv_sec  = ns / 1000000;
+        timeout.tv_usec = ns % 1000000;
+    }
+    select(fd + 1, &mask, NULL, NULL, (ns >= 0) ? &timeout : NULL);
+}
+
+/* Returns True when the program should exit */
+static
+Bool xcb_handle_event(XcbDizzy *xd, xcb_generic_event_t *ev, Bool *exposed)
+{
+    switch (ev->response_type & ~0x80) {
+        case XCB_MAP_NOTIFY:
+            Log(("MapNotify: resuming...\n"));
+            xd->paused = False;
+            break;
+        case XCB_UNMAP_NOTIFY:
+            Log(("UnmapNotify: pausing...\n"));
+            xd->paused = True;
+            break;
+        case XCB_VISIBILITY_NOTIFY:
+            xd->paused = (((xcb_visibility_notify_event_t *)ev)->state ==
+                          XCB_VISIBILITY_FULLY_OBSCURED);
+            break;
+        case XCB_EXPOSE:
+            *exposed = True;
+            break;
+        case XCB_CONFIGURE_NOTIFY: {
+            xcb_configure_notify_event_t *ce = (xcb_configure_notify_event_t *)ev;
+
+            if (ce->width != xd->width || ce->height != xd->height) {
+                xd->width  = ce->width;
+                xd->height = ce->height;
+                if (xd->ring_pixmap != XCB_NONE) {
+                    xcb_free_pixmap(xd->c, xd->ring_pixmap);
+                    xd->ring_pixmap = XCB_NONE;
+                }
+            }
+            break;
+        }
+        case XCB_BUTTON_PRESS:
+            switch (((xcb_button_press_event_t *)ev)->detail) {
+                case 1:
+                    Msg(("ButtonPress: faster: %g\n", xd->delta));
+                    xd->delta += 0.005;
+                    break;
+                case 2:
+                    Msg(("ButtonPress: slower: %g\n", xd->delta));
+                    xd->delta += -0.005;
+                    break;
+                case 3:
+                    xd->manual_paused = !xd->manual_paused;
+                    Msg(("ButtonPress: manual %s.\n",
+                         xd->manual_paused ? "pause" : "resume"));
+                    break;
+            }
+            break;
+        case XCB_KEY_PRESS:
+            Msg(("KeyPress: done.\n"));
+            return (True);
+    }
+    return (False);
+}
+
+int xcb_dizzy_run(const DizzyOptions *opts)
+{
+    XcbDizzy             xd;
+    FrameClock           clock;
+    FrameTimes           times;
+    xcb_generic_event_t *ev;
+    int                  screennum, i;
+    Bool                 done = False, exposed = False, started = False;
+
+    memset(&xd, 0, sizeof(xd));
+    xd.opts  = opts;
+    xd.delta = opts->delta;
+    scene_lists_init(&xd.scene, opts->scene, opts->cull);
+    xd.drawlist.line_width = opts->scene->line_width;
+
+    xd.c = xcb_connect(opts->display_name, &screennum);
+    if (xcb_connection_has_error(xd.c)) {
+        fprintf(stderr, "%s: Cannot open display %s\n", ProgramName,
+                opts->display_name ? opts->display_name : "");
+        exit(EXIT_FAILURE);
+    }
+    {
+        xcb_screen_iterator_t si;
+
+        si = xcb_setup_roots_iterator(xcb_get_setup(xd.c));
+        for (i = 0; i < screennum; i++)
+            xcb_screen_next(&si);
+        xd.screen = si.data;
+    }
+
+    xcb_setup_window(&xd);
+
+    if (opts->bench_frames > 0 &&
+        !frame_times_init(&times, opts->bench_frames)) {
+        fprintf(stderr, "%s: Cannot allocate %d frame samples.\n",
+                ProgramName, opts->bench_frames);
+        exit(EXIT_FAILURE);
+    }
+    frame_clock_init(&clock, opts->fps, opts->catchup);
+
+    while (!done) {
+        int64_t now, wait;
+
+        while (!done && (ev = xcb_poll_for_event(xd.c)) != NULL) {
+            done = xcb_handle_event(&xd, ev, &exposed);
+            free(ev);
+        }
+        if (xcb_connection_has_error(xd.c))
+            fatal("connection to the X server lost");
+        if (done)
+            break;
+
+        if (!started) {
+            if (!exposed) {
+                xcb_wait(&xd, -1);
+                continue;
+            }
+            started = True;
+            if (opts->bench_frames > 0 || verbose) {
+                fprintf(stdout, "%s: startup to first Expose: %.3f ms\n",
+                        ProgramName,
+                        (dizzy_now_ns() - opts->startup_begin) / 1e6);
+            }
+            if (opts->bench_frames > 0)
+                times.begin = dizzy_now_ns();
+        }
+
+        if ((xd.paused || xd.manual_paused) && opts->bench_frames == 0) {
+            frame_clock_reset(&clock);
+            xcb_wait(&xd, -1);
+            continue;
+        }
+
+        now  = dizzy_now_ns();
+        wait = frame_clock_timeout(&clock, now);
+        if (wait > 0) {
+            xcb_wait(&xd, wait);
+            continue;
+        }
+
+        xd.rotation += xd.delta * frame_clock_tick(&clock, now);
+        clock.frames++;
+        if (opts->bench_frames > 0) {
+            int64_t t1, t2, t3;
+
+            xcb_draw_scene(&xd);
+            t1 = dizzy_now_ns();
+            xcb_swap_buffers(&xd);
+            t2 = dizzy_now_ns();
+            xcb_sync(&xd);
+            t3 = dizzy_now_ns();
+            frame_times_add(&times, t1 - now, t2 - t1, t3 - t2);
+            if (times.count == opts->bench_frames)
+                done = True;
+        }
+        else {
+            xcb_draw_scene(&xd);
+            xcb_swap_buffers(&xd);
+            xcb_flush(xd.c);
+        }
+    }
+
+    if (opts->bench_frames > 0) {
+        times.end = dizzy_now_ns();
+        frame_times_report(stdout, ProgramName, &times);
+        frame_times_free(&times);
+    }
+    Log(("%lu frames, %lu late, %lu skipped.\n",
+         clock.frames, clock.late, clock.skipped));
+
+    xcb_disconnect(xd.c);
+    draw_list_free(&xd.drawlist);
+    scene_lists_free(&xd.scene);
+    return (EXIT_SUCCESS);
+}
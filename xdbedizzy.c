@@ -48,54 +48,207 @@
 #include <math.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
 #include <X11/Xpoll.h>
+#include "xdbedizzy.h"
 
 /* Turn a NULL pointer string into an empty string */
 #define NULLSTR(x) (((x)!=NULL)?(x):(""))
-#define Log(x) { if(verbose) printf x; }
-#define Msg(x) { printf x; }
+
+/* Frames kept by -stats; older ones are overwritten */
+#define STATS_FRAMES 16384
+
+/* A size is considered settled once no ConfigureNotify changed it for
+ * this long; only then is the ring cache rebuilt for it */
+#define RESIZE_SETTLE 100000000LL
+
+/* Frames of -resizebench that wait at most this long for the window
+ * manager to grant a size */
+#define RESIZE_TIMEOUT 1000000000LL
+
+enum {
+    BACKEND_XLIB,       /* core protocol drawing through Xlib */
+    BACKEND_XCB,        /* the same over a native XCB connection */
+    BACKEND_SHM,        /* client side rasterizer, XShmPutImage */
+    BACKEND_PRESENT,    /* pixmap pool shown with PresentPixmap */
+    BACKEND_RENDER,     /* antialiased triangles through XRender */
+    NUM_BACKENDS
+};
+
+/*
+ * Everything that belongs to one window.  With -windows or a list of
+ * displays each window has its own connection and is rendered by its own
+ * thread, so nothing in here is shared between threads.
+ */
+typedef struct {
+    int              index;
+    int              display;       /* index into |display_names| */
+    int              cpu;           /* -pin: CPU of the thread, else -1 */
+    Display         *dpy;
+    Screen          *screen;
+    int              screennum;
+    int              depth;
+    XRectangle       winrect;
+    int64_t          resized;       /* last size change, 0 = settled */
+    unsigned long    pixels[MAX_COLORS];
+    Window           win;
+    XID              buf;
+    XdbeSwapInfo     swapInfo;
+    GC               gcs[MAX_COLORS];
+    DrawList         drawlist;
+    SceneLists       scene;
+    Pixmap           ring_pixmap;
+    XRectangle       ring_box;      /* relative to ring center */
+    XRectangle       drawn[2];      /* content of the last two frames */
+    int              ndrawn;        /* valid entries in |drawn| */
+    Bool             clip_set;
+    float            rotation;
+    float            delta;
+    Bool             paused;
+    Bool             manual_paused;
+    FrameClock       clock;
+
+    /* Results, reported once all windows are done */
+    unsigned long    frames;
+    int64_t          begin, end;
+    int64_t          exposed;       /* time of the first Expose event */
+    int64_t          opened;        /* startup phases for -timestartup */
+    int64_t          connected;
+    int64_t          visual_chosen;
+    int64_t          colors_done;
+    int64_t          mapped;
+    int64_t          first_frame;
+    Bool             visual_cached;
+    FrameLag         lag;
+    LodGovernor      lod;
+    FrameTimes       times;
+    FrameStats       stats;
+    LatencyProbe     probe;
+    pthread_t        thread;
+} DizzyWindow;
 
 /* Global variables */
-static char             *ProgramName   = NULL;
-static Display          *dpy           = NULL;
-static Screen           *screen        = NULL;
-static int               screennum     = -1;
-static XRectangle        winrect       = { 0 };
-static unsigned long     c_black, c_pink, c_green, c_orange, c_blue;
-static Window            win           = None;
-static XID               buf           = None;
-static XdbeSwapInfo      swapInfo      = { 0 };
-static GC                gc_black, gc_pink, gc_green, gc_orange, gc_blue;
-static float             rotation      = 0.0;
+char                    *ProgramName   = NULL;
+static DizzyWindow      *windows       = NULL;
 static float             delta         = 0.05;
 static float             speed         = 20.0;
-static Bool              paused        = False;
-static Bool              manual_paused = False;
+static double            fps           = -1.0; /* < 0: derive from |speed| */
+static pthread_mutex_t   quit_lock     = PTHREAD_MUTEX_INITIALIZER;
+static Bool              quit          = False;
+static pthread_mutex_t   dump_lock     = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t dump_requested = 0;
 
 /* Default values for unspecified command line arguments */
 static char             *display_name  = NULL;
+static char            **display_names = NULL;
+static int               num_displays  = 1;
+static Bool              pin_threads   = False;
 static int               visclass      = PseudoColor;
 static int               depth         = 0;
 static Bool              listVis       = False;
 static int               spokes        = 12;
 static Bool              do_db         = True;
-static Bool              verbose       = False;
+Bool                     verbose       = False;
 static Bool              synchronous   = False;
+static Bool              catchup       = False;
+static Bool              use_ring_cache = True;
+static Bool              use_cull      = True;
+static Bool              use_visual_cache = True;
+static Bool              time_startup  = False;
+static int               latency_probes = 0;
+static XdbeSwapAction    swap_action   = XdbeBackground;
+static int               bench_frames  = 0;
+static int               resize_frames = 0;
+static char             *capture_path  = NULL;
+static char             *record_path   = NULL;
+static char             *replay_path   = NULL;
+static Bool              replay_timed  = False;
+static int               replay_frames = 0;
+static int               replay_width, replay_height;
+static int               kernel_frames = 0;
+static int               cpu_frames    = 0;
+static int               backend       = BACKEND_XLIB;
+static int               num_windows   = 1;
+static char             *stats_file    = NULL;
+static int               stats_format  = STATS_CSV;
+static int               stats_sync    = 60;
+static int               max_lag       = -1;  /* < 0: 2 with -lod, else 0 */
+static Bool              use_lod       = False;
+static int64_t           startup_begin = 0;
 static VisualID          visid         = 0;
+static char             *scene_file    = NULL;
+static Scene             scene;
+static char             *control_path  = NULL;
+static ControlServer     control;
+
+static const char *backend_names[NUM_BACKENDS] = {
+    "xlib", "xcb", "shm", "present", "render"
+};
+
+static const Bool backend_built[NUM_BACKENDS] = {
+    True,
+#ifdef HAVE_XCB
+    True,
+#else
+    False,
+#endif
+    True,
+#ifdef HAVE_PRESENT
+    True,
+#else
+    False,
+#endif
+#ifdef HAVE_XRENDER
+    True
+#else
+    False
+#endif
+};
+
+static const char *swap_action_names[] = {
+    "undefined", "background", "untouched", "copied"
+};
 
 static const char *help_message[] = {
 "  where options include:",
-"    -display host:dpy       X server connection to use.",
+"    -display host:dpy[,...] X server connection(s) to use, windows go round robin.",
 "    -delta dlt              Rotate <dlt> per frame (video) or page (printer).",
 "    -class classname        Class of visual to use.",
 "    -depth n                Depth of visual to use.",
 "    -visid [nn,0xnn]        Visual ID to use (ignore -class, -depth).",
 "    -list                   List double buffer capable visuals.",
 "    -nodb                   Single buffer (ignore -class, -depth, -visid).",
+"    -noringcache            Rasterize the rings every frame instead of copying them.",
+"    -nocull                 Also send rings off the window and sub-pixel spokes.",
+"    -novisualcache          Query the double buffer visuals instead of using the cache.",
+"    -swapaction action      DBE swap action: background, untouched, copied, undefined.",
 "    -help                   Print this message.",
-"    -speed val              Floating-point value to set the speed.",
+"    -speed val              Floating-point value to set the speed (fps = val/2).",
+"    -fps n                  Target frame rate, 0 renders as fast as possible.",
+"    -catchup                Render missed frames late instead of skipping them.",
+"    -benchmark n            Render n frames, print frame time statistics, exit.",
+"    -capture file           With -benchmark, store and hash every frame, fixed rotation.",
+"    -record file            Write the primitives of every frame to a trace file.",
+"    -replay file            Send the frames of a trace to the server, report, exit.",
+"    -replaytimed            Replay the frames at their recorded times.",
+"    -resizebench n          Resize the window through a set of sizes, time n frames at each, exit.",
+"    -timestartup            Print how long each startup phase took up to the first frame.",
+"    -latency n              Click into the window n times with XTEST, report input to swap latency.",
+"    -kernelbench n          Time n frames of spoke geometry (no display), exit.",
+"    -cpubench n             Time n frames of the frame pipeline (no display), exit.",
+"    -backend name           Rendering backend: xlib (default), xcb, shm, present, render.",
+"    -windows n              Open n windows, each with its own connection and thread.",
+"    -pin                    Bind every window thread to a CPU of its own.",
+"    -stats file             Record per-frame protocol statistics, write them to file.",
+"    -statsformat format     Format of the -stats file: csv (default), json.",
+"    -statssync n            Time an XSync() round trip every n frames (default 60).",
+"    -maxlag n               Start no frame while n frames wait in the server (0: no limit).",
+"    -lod                    Lower the detail when frames take longer than the frame period.",
 "    -sync                   Use synchronous X connection.",
 "    -spokes n               Specify number of spokes to draw.",
+"    -scene file             Draw the scene described in file.",
+"    -control path           Accept tuning commands on the Unix domain socket path.",
 "    -verbose                Produce chatty messages while running.",
 NULL};
 
@@ -113,72 +266,564 @@ void usage(void)
 }
 
 
+/* Send |dl| to |d| with the drawing requests of the backend; |clip| is
+ * the clip rectangle set with set_clip(), NULL if there is none */
 static
-unsigned long getColor(Colormap cmap, const char *color_name)
+void emit_draw_list(DizzyWindow *w, Drawable d, const XRectangle *clip,
+                    const DrawList *dl)
 {
-    XColor color;
-    XColor exact;
-    int    status;
-
-    status = XAllocNamedColor(dpy, cmap, color_name, &color, &exact);
-    if (status == 0) {
-        fprintf(stderr, "%s: Couldn't get color: %s\n", ProgramName, color_name);
-        exit(EXIT_FAILURE);
+#ifdef HAVE_XRENDER
+    if (backend == BACKEND_RENDER) {
+        render_draw(d, clip, dl);
+        return;
     }
-    return (color.pixel);
+#else
+    (void) clip;
+#endif
+    draw_list_emit(w->dpy, d, w->gcs, dl);
+}
+
+/* The draw list of the frame if it was sent with core protocol
+ * requests, for -stats; NULL for the backends that send something else */
+static
+const DrawList *core_draw_list(const DizzyWindow *w)
+{
+    if (backend == BACKEND_SHM || backend == BACKEND_RENDER)
+        return (NULL);
+    return (&w->drawlist);
+}
+
+/* Build the primitives of the current frame at the level of detail
+ * chosen by -lod.  The rings are left out if they come from the ring
+ * cache. */
+static
+void build_scene(DizzyWindow *w, Bool with_rings)
+{
+    scene_build_frame(&w->drawlist, &w->scene, &w->lod, w->rotation,
+                      w->winrect.width, w->winrect.height,
+                      with_rings, use_cull);
 }
 
+/*
+ * The rings only move by the wobble offset from frame to frame, so they
+ * are rasterized once into a pixmap RING_WOBBLE pixels larger than the
+ * window on every side, over the background color, and every frame
+ * copies the window sized part at the current offset.  The copy covers
+ * the whole window, so it also takes the place of clearing it.
+ */
+static
+void update_ring_cache(DizzyWindow *w)
+{
+    DrawList   rings;
+    int        width  = w->winrect.width;
+    int        height = w->winrect.height;
+    XRectangle view;
+
+    if (w->ring_pixmap != None)
+        return;
+
+    w->ring_pixmap = XCreatePixmap(w->dpy, w->win,
+                                   width  + 2 * RING_WOBBLE,
+                                   height + 2 * RING_WOBBLE, w->depth);
+    XFillRectangle(w->dpy, w->ring_pixmap, w->gcs[COLOR_BACKGROUND], 0, 0,
+                   width  + 2 * RING_WOBBLE,
+                   height + 2 * RING_WOBBLE);
 
+    memset(&rings, 0, sizeof(rings));
+    rings.line_width = scene.line_width;
+    scene_add_rings(&rings, &w->scene,
+                    width  / 2 + RING_WOBBLE,
+                    height / 2 + RING_WOBBLE, 1);
+    if (use_cull) {
+        view.x      = 0;
+        view.y      = 0;
+        view.width  = width  + 2 * RING_WOBBLE;
+        view.height = height + 2 * RING_WOBBLE;
+        draw_list_cull_arcs(&rings, &view, scene.line_width);
+    }
+    emit_draw_list(w, w->ring_pixmap, NULL, &rings);
+
+    /* Extent of the rings around their center, for damage tracking */
+    draw_list_bounds(&rings, scene.line_width, &w->ring_box);
+    w->ring_box.x -= width  / 2 + RING_WOBBLE;
+    w->ring_box.y -= height / 2 + RING_WOBBLE;
+    draw_list_free(&rings);
 
-#define RATIO1 0.4
-#define RATIO2 0.7
-#define RATIO3 0.95
+    Log(("Ring cache rebuilt for %dx%d.\n", width, height));
+}
 
-#ifndef M_PI
-#define M_PI 3.1415927
+static
+void invalidate_ring_cache(DizzyWindow *w)
+{
+    if (w->ring_pixmap != None) {
+#ifdef HAVE_XRENDER
+        if (backend == BACKEND_RENDER)
+            render_forget(w->ring_pixmap);
 #endif
+        XFreePixmap(w->dpy, w->ring_pixmap);
+        w->ring_pixmap = None;
+    }
+}
+
+/* Track the window size; anything cached for the old size is dropped */
+static
+void set_window_size(DizzyWindow *w, int width, int height)
+{
+    if (width == w->winrect.width && height == w->winrect.height)
+        return;
+    w->winrect.width  = width;
+    w->winrect.height = height;
+    w->resized        = dizzy_now_ns();
+    invalidate_ring_cache(w);
+    /* the server reallocates the back buffer, its contents are gone */
+    w->ndrawn = 0;
+}
+
+/*
+ * True while the window is being resized, e.g. dragged by the user:
+ * the size changed less than RESIZE_SETTLE ago, so a ring cache built
+ * now would probably be thrown away with the next ConfigureNotify.
+ * Until the size settles the rings are drawn directly.
+ */
+static
+Bool resizing(DizzyWindow *w)
+{
+    if (w->resized != 0 && dizzy_now_ns() - w->resized >= RESIZE_SETTLE)
+        w->resized = 0;
+    return (w->resized != 0);
+}
+
+/*
+ * With the XdbeUntouched and XdbeCopied swap actions the back buffer
+ * keeps a previous frame, so only the area that changed needs to be
+ * cleared and drawn again
+ */
+static
+Bool partial_redraw(void)
+{
+    return (do_db &&
+            (swap_action == XdbeUntouched || swap_action == XdbeCopied));
+}
+
+static
+void set_clip(DizzyWindow *w, const XRectangle *clip)
+{
+    int i;
+
+    for (i = 0; i < scene.ncolors; i++) {
+        if (clip)
+            XSetClipRectangles(w->dpy, w->gcs[i], 0, 0, (XRectangle *)clip, 1, YXBanded);
+        else
+            XSetClipMask(w->dpy, w->gcs[i], None);
+    }
+    w->clip_set = (clip != NULL);
+}
+
+/*
+ * Area of the back buffer that must be redrawn for a frame whose
+ * content lies within |cur|: the new content plus whatever the back
+ * buffer still holds from an older frame.  After a swap the back buffer
+ * holds the frame just shown for XdbeCopied, and the one before that
+ * for XdbeUntouched.
+ */
+static
+void damage_area(DizzyWindow *w, const XRectangle *cur, XRectangle *dirty)
+{
+    XRectangle full;
+    int        age = (swap_action == XdbeCopied) ? 0 : 1;
 
-#define S_ANGLE(s) (M_PI*2./(s))
+    full.x      = 0;
+    full.y      = 0;
+    full.width  = w->winrect.width;
+    full.height = w->winrect.height;
+
+    if (w->ndrawn <= age) {
+        *dirty = full;
+    }
+    else {
+        *dirty = *cur;
+        rect_union(dirty, &w->drawn[age]);
+        rect_intersect(dirty, &full);
+    }
+    w->drawn[1] = w->drawn[0];
+    w->drawn[0] = *cur;
+    if (w->ndrawn < 2)
+        w->ndrawn++;
+}
 
 static
-void redraw(void)
+void draw_scene(DizzyWindow *w)
 {
-    int     i;
-    int     x, y;
-    XPoint  pnt[4];
+    XRectangle dirty, cur;
+    Drawable   d  = w->buf;
+    int        ox = (int) (sin(w->rotation * 2) * RING_WOBBLE);
+    int        oy = (int) (cos(w->rotation * 2) * RING_WOBBLE);
+    Bool       cached;
+
+    if (backend == BACKEND_SHM) {
+        /* The image covers the whole window, background included */
+        build_scene(w, True);
+        raster_draw(&w->drawlist, w->pixels, w->pixels[COLOR_BACKGROUND],
+                    w->winrect.width, w->winrect.height);
+        raster_present(w->buf, w->gcs[COLOR_BACKGROUND]);
+        return;
+    }
+
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT)
+        d = present_next_pixmap(w->winrect.width, w->winrect.height);
+#endif
+
+    cached = use_ring_cache && !resizing(w);
+    build_scene(w, !cached);
+    if (cached)
+        update_ring_cache(w);
 
-    Log(("redraw.\n"));
+    dirty.x      = 0;
+    dirty.y      = 0;
+    dirty.width  = w->winrect.width;
+    dirty.height = w->winrect.height;
 
-    /* the double-buffer extension will clear the buffer itself */
-    if (!do_db) {
-        XClearWindow(dpy, win);
+    if (partial_redraw()) {
+        draw_list_bounds(&w->drawlist, scene.line_width, &cur);
+        if (cached) {
+            XRectangle rings = w->ring_box;
+
+            rings.x += w->winrect.width  / 2 + ox;
+            rings.y += w->winrect.height / 2 + oy;
+            rect_union(&cur, &rings);
+        }
+        damage_area(w, &cur, &dirty);
+        if (dirty.width == 0 || dirty.height == 0)
+            return;
+        set_clip(w, &dirty);
     }
-    x = winrect.width / 2;
-    x += (int) (sin(rotation * 2) * 20);
-    y = winrect.height / 2;
-    y += (int) (cos(rotation * 2) * 20);
-    for (i = 5; i < 26; i += 3) {
-        XDrawArc(dpy, buf, gc_orange, x - i * 10,      y - i * 10,      i * 20,      i * 20,      0, 360 * 64);
-        XDrawArc(dpy, buf, gc_green,  x - i * 10 - 5,  y - i * 10 - 5,  i * 20 + 10, i * 20 + 10, 0, 360 * 64);
-        XDrawArc(dpy, buf, gc_blue,   x - i * 10 - 10, y - i * 10 - 10, i * 20 + 20, i * 20 + 20, 0, 360 * 64);
+    else if (w->clip_set) {
+        set_clip(w, NULL);
     }
 
-    x = winrect.width  / 2;
-    y = winrect.height / 2;
-    pnt[0].x = x;
-    pnt[0].y = y;
-    for (i = 0; i < spokes; i++) {
-        pnt[1].x = (int) (cos(i * S_ANGLE(spokes) + rotation)       * (RATIO1 * x)) + x;
-        pnt[1].y = (int) (sin(i * S_ANGLE(spokes) + rotation)       * (RATIO1 * y)) + y;
-        pnt[2].x = (int) (cos(i * S_ANGLE(spokes) + rotation - 0.1) * (RATIO2 * x)) + x;
-        pnt[2].y = (int) (sin(i * S_ANGLE(spokes) + rotation - 0.1) * (RATIO2 * y)) + y;
-        pnt[3].x = (int) (cos(i * S_ANGLE(spokes) + rotation - 0.2) * (RATIO3 * x)) + x;
-        pnt[3].y = (int) (sin(i * S_ANGLE(spokes) + rotation - 0.2) * (RATIO3 * y)) + y;
-        XDrawLines(dpy, buf, gc_pink, pnt, 4, CoordModeOrigin);
+    if (cached) {
+        XCopyArea(w->dpy, w->ring_pixmap, d, w->gcs[COLOR_BACKGROUND],
+                  RING_WOBBLE - ox + dirty.x, RING_WOBBLE - oy + dirty.y,
+                  dirty.width, dirty.height, dirty.x, dirty.y);
+    }
+    else if (d == w->win) {
+        XClearWindow(w->dpy, w->win);
+    }
+    else if (d != w->buf || swap_action != XdbeBackground) {
+        /* Only XdbeBackground makes the server clear the back buffer */
+        XFillRectangle(w->dpy, d, w->gcs[COLOR_BACKGROUND],
+                       dirty.x, dirty.y, dirty.width, dirty.height);
     }
+    emit_draw_list(w, d, w->clip_set ? &dirty : NULL, &w->drawlist);
+}
 
+static
+void swap_buffers(DizzyWindow *w)
+{
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT) {
+        present_submit();
+        return;
+    }
+#endif
     if (do_db) {
-        XdbeSwapBuffers(dpy, &swapInfo, 1);
+        XdbeSwapBuffers(w->dpy, &w->swapInfo, 1);
+    }
+}
+
+/* Wait until the server has finished the last frame; with Present
+ * until it is on the screen */
+static
+void finish_frame(DizzyWindow *w)
+{
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT) {
+        present_wait(0);
+        return;
+    }
+#endif
+    XSync(w->dpy, False);
+}
+
+/* What the reports of |w| start with */
+static
+void window_prefix(const DizzyWindow *w, char *prefix, size_t size)
+{
+    if (num_displays > 1)
+        snprintf(prefix, size, "%s: window %d on %s", ProgramName, w->index,
+                 display_names[w->display]);
+    else if (num_windows > 1)
+        snprintf(prefix, size, "%s: window %d", ProgramName, w->index);
+    else
+        snprintf(prefix, size, "%s", ProgramName);
+}
+
+/*
+ * -timestartup: once the server has the first frame, print how long
+ * each phase of open_window() took and the total since program start
+ */
+static
+void report_startup(DizzyWindow *w)
+{
+    char prefix[128];
+
+    XSync(w->dpy, False);
+    w->first_frame = dizzy_now_ns();
+
+    window_prefix(w, prefix, sizeof(prefix));
+    fprintf(stdout, "%s: startup: connect %.3f ms, visual %.3f ms (%s), "
+            "colors %.3f ms, window %.3f ms, first frame %.3f ms, "
+            "total %.3f ms\n", prefix,
+            (w->connected     - w->opened)        / 1e6,
+            (w->visual_chosen - w->connected)     / 1e6,
+            !do_db ? "default" : w->visual_cached ? "cached" : "queried",
+            (w->colors_done   - w->visual_chosen) / 1e6,
+            (w->mapped        - w->colors_done)   / 1e6,
+            (w->first_frame   - w->mapped)        / 1e6,
+            (w->first_frame   - startup_begin)    / 1e6);
+}
+
+static
+void redraw(DizzyWindow *w)
+{
+    /* The trace paces -replaytimed on the start of each frame */
+    int64_t start = dizzy_now_ns();
+
+    draw_scene(w);
+    swap_buffers(w);
+    if (record_path != NULL) {
+        trace_record_frame(&w->drawlist, w->winrect.width, w->winrect.height,
+                           start);
+    }
+    frame_lag_mark(&w->lag);
+    if (time_startup && w->first_frame == 0)
+        report_startup(w);
+#ifdef HAVE_XTEST
+    /* The first frame after the probe's ButtonPress shows its effect */
+    if (latency_probes > 0)
+        latency_swapped(&w->probe, w->dpy);
+#endif
+}
+
+static
+void log_lod(const DizzyWindow *w)
+{
+    double rim = spoke_rim(RATIO3, w->winrect.width / 2,
+                           w->winrect.height / 2);
+
+    Log(("Window %d: detail level %d: %d of %d spokes, every %d. ring%s.\n",
+         w->index, w->lod.level,
+         lod_spokes(&w->lod, spokes, rim, scene.line_width), spokes,
+         lod_ring_step(&w->lod),
+         lod_skip_frame(&w->lod, 1) ? ", every other frame" : ""));
+}
+
+/* Ask all windows to finish, e.g. after a key press in one of them */
+static
+void quit_all(DizzyWindow *w)
+{
+    XEvent ev;
+    int    i;
+
+    pthread_mutex_lock(&quit_lock);
+    quit = True;
+    pthread_mutex_unlock(&quit_lock);
+
+    /* Wake up the other threads, they may be blocked in XNextEvent().
+     * Each window may be on another server, so the event is sent over
+     * the connection of the window; the connections stay open until
+     * every thread has finished. */
+    memset(&ev, 0, sizeof(ev));
+    ev.xclient.type   = ClientMessage;
+    ev.xclient.format = 32;
+    for (i = 0; i < num_windows; i++) {
+        if (&windows[i] == w)
+            continue;
+        ev.xclient.window = windows[i].win;
+        XSendEvent(windows[i].dpy, windows[i].win, False, NoEventMask, &ev);
+        XFlush(windows[i].dpy);
+    }
+}
+
+static
+Bool quitting(void)
+{
+    Bool q;
+
+    pthread_mutex_lock(&quit_lock);
+    q = quit;
+    pthread_mutex_unlock(&quit_lock);
+    return (q);
+}
+
+/* Write the -stats file with the frames of all windows */
+static
+void dump_stats(void)
+{
+    FrameStats **stats;
+    int          i;
+
+    stats = malloc(num_windows * sizeof(FrameStats *));
+    if (stats == NULL)
+        return;
+    for (i = 0; i < num_windows; i++)
+        stats[i] = &windows[i].stats;
+    pthread_mutex_lock(&dump_lock);
+    if (frame_stats_dump(stats_file, stats_format, stats, num_windows))
+        Log(("Statistics written to %s.\n", stats_file));
+    pthread_mutex_unlock(&dump_lock);
+    free(stats);
+}
+
+static
+void dump_signal(int sig)
+{
+    (void) sig;
+    dump_requested = 1;
+}
+
+/* Honor a SIGUSR1 that arrived since the last call; any thread can */
+static
+void check_dump_request(void)
+{
+    if (!dump_requested)
+        return;
+    pthread_mutex_lock(&dump_lock);
+    if (dump_requested) {
+        dump_requested = 0;
+        pthread_mutex_unlock(&dump_lock);
+        dump_stats();
+        return;
+    }
+    pthread_mutex_unlock(&dump_lock);
+}
+
+
+/* Allocate a new back buffer for |w| with |action| in place of the old
+ * one; returns False without double buffering */
+static
+Bool set_swap_action(DizzyWindow *w, XdbeSwapAction action)
+{
+    if (!do_db)
+        return (False);
+    if (action == swap_action)
+        return (True);
+#ifdef HAVE_XRENDER
+    if (backend == BACKEND_RENDER)
+        render_forget(w->buf);
+#endif
+    /* A window has a single back buffer; the swap action of a second
+     * name for it would be ignored */
+    XdbeDeallocateBackBufferName(w->dpy, w->buf);
+    w->buf = XdbeAllocateBackBufferName(w->dpy, w->win, action);
+    w->swapInfo.swap_action = action;
+    swap_action = action;
+    /* The new back buffer holds none of the previous frames */
+    w->ndrawn = 0;
+    Log(("Swap action: %s.\n", swap_action_names[swap_action]));
+    return (True);
+}
+
+/* Parse all of |str| as a number */
+static
+Bool parse_number(const char *str, double *v)
+{
+    char *end;
+
+    errno = 0;
+    *v = strtod(str, &end);
+    return (errno == 0 && end != str && *end == '\0');
+}
+
+/*
+ * Run a command from the -control socket on the window |data|; it runs
+ * between two frames of the main loop.  See the manual page for the
+ * commands.
+ */
+static
+void control_command(void *data, int argc, char **argv,
+                     char *reply, size_t size)
+{
+    DizzyWindow *w   = data;
+    const char  *cmd = argv[0];
+    double       v   = 0.;
+    int          a;
+
+    if (argc > 2 ||
+        (argc == 2 && strcmp(cmd, "swapaction") && !parse_number(argv[1], &v))) {
+        snprintf(reply, size, "error bad arguments to %s", cmd);
+    }
+    else if (!strcmp(cmd, "stats") && argc == 1) {
+        double seconds = (dizzy_now_ns() - w->begin) / 1e9;
+
+        snprintf(reply, size,
+                 "ok frames %lu late %lu skipped %lu seconds %.3f "
+                 "rate %.1f fps %g delta %g spokes %d lod %d paused %d "
+                 "swapaction %s",
+                 w->clock.frames, w->clock.late, w->clock.skipped, seconds,
+                 (seconds > 0.) ? w->clock.frames / seconds : 0.,
+                 fps, w->delta, spokes, w->lod.level,
+                 w->paused || w->manual_paused,
+                 do_db ? swap_action_names[swap_action] : "none");
+    }
+    else if ((!strcmp(cmd, "fps") || !strcmp(cmd, "speed")) && argc == 2) {
+        /* -speed sets the frame rate to half its value */
+        if (!strcmp(cmd, "speed"))
+            v /= 2.;
+        if (v < 0. || (v == 0. && use_lod)) {
+            snprintf(reply, size, "error bad frame rate %g", v);
+            return;
+        }
+        fps = v;
+        frame_clock_set_rate(&w->clock, fps);
+        if (use_lod)
+            lod_init(&w->lod, (int64_t) (1e9 / fps));
+        snprintf(reply, size, "ok fps %g", fps);
+    }
+    else if (!strcmp(cmd, "delta") && argc == 2) {
+        w->delta = v;
+        snprintf(reply, size, "ok delta %g", w->delta);
+    }
+    else if (!strcmp(cmd, "spokes") && argc == 2) {
+        if (v < 0. || v != (int) v) {
+            snprintf(reply, size, "error bad spoke count %g", v);
+            return;
+        }
+        spokes = (int) v;
+        scene_set_spokes(&scene, spokes);
+        snprintf(reply, size, "ok spokes %d", spokes);
+    }
+    else if (!strcmp(cmd, "pause") && argc == 1) {
+        w->manual_paused = True;
+        snprintf(reply, size, "ok paused");
+    }
+    else if (!strcmp(cmd, "resume") && argc == 1) {
+        w->manual_paused = False;
+        snprintf(reply, size, "ok resumed");
+    }
+    else if (!strcmp(cmd, "swapaction") && argc == 2) {
+        for (a = 0; a < 4; a++) {
+            if (!strcmp(argv[1], swap_action_names[a]))
+                break;
+        }
+        if (a == 4)
+            snprintf(reply, size, "error bad swap action %s", argv[1]);
+        else if (!set_swap_action(w, a))
+            snprintf(reply, size, "error not double buffered");
+        else
+            snprintf(reply, size, "ok swapaction %s", swap_action_names[a]);
+    }
+    else if (!strcmp(cmd, "quit") && argc == 1) {
+        quit_all(w);
+        snprintf(reply, size, "ok");
+    }
+    else if (!strcmp(cmd, "help")) {
+        snprintf(reply, size, "ok stats, fps n, speed n, delta n, spokes n, "
+                 "pause, resume, swapaction action, quit");
+    }
+    else {
+        snprintf(reply, size, "error unknown command %s", cmd);
     }
 }
 
@@ -194,9 +839,9 @@ choose_DB_visual( /* Input */         Display *dpy, Bool listVis, int visclass,
     int                    i, nitems;
     int                    chosenDepth = 0;
     Visual                *chosenVisual = NULL;
-    XVisualInfo            vinfo_template, *XvisInfo;
+    XVisualInfo            vinfo_template, *XvisInfo, *XvisAll;
 
-    screen_list[0] = XRootWindowOfScreen(screen);
+    screen_list[0] = XDefaultRootWindow(dpy);
     num_screens = 1;
     DBEvisInfo = XdbeGetVisualInfo(dpy, screen_list, &num_screens);
     if (DBEvisInfo == NULL) {
@@ -204,19 +849,30 @@ choose_DB_visual( /* Input */         Display *dpy, Bool listVis, int visclass,
         return (NULL);
     }
 
+    /* All visuals of the screen at once, to look the DBE ones up in */
+    vinfo_template.screen = XDefaultScreen(dpy);
+    XvisAll = XGetVisualInfo(dpy, VisualScreenMask, &vinfo_template, &nitems);
+
     if (listVis) {
         printf("\nThe double buffer capable visuals are:\n");
         printf("      visual ID    depth    class\n");
     }
     for (i = 0; i < DBEvisInfo->count; i++) {
+        int j;
 
-        vinfo_template.visualid = DBEvisInfo->visinfo[i].visual;
-        XvisInfo = XGetVisualInfo(dpy, VisualIDMask,
-                                   &vinfo_template, &nitems);
+        XvisInfo = NULL;
+        for (j = 0; XvisAll != NULL && j < nitems; j++) {
+            if (XvisAll[j].visualid == DBEvisInfo->visinfo[i].visual) {
+                XvisInfo = &XvisAll[j];
+                break;
+            }
+        }
         if (XvisInfo == NULL) {
             fprintf(stderr,
                     "%s: XGetVisualInfo returned NULL for visual %d\n",
-                    ProgramName, (int)vinfo_template.visualid);
+                    ProgramName, (int)DBEvisInfo->visinfo[i].visual);
+            XFree(XvisAll);
+            XdbeFreeVisualInfo(DBEvisInfo);
             return (NULL);
         }
         if (listVis) {
@@ -264,6 +920,9 @@ choose_DB_visual( /* Input */         Display *dpy, Bool listVis, int visclass,
         }
     }
 
+    XFree(XvisAll);
+    XdbeFreeVisualInfo(DBEvisInfo);
+
     if (chosenVisual) {
         if (listVis) {
             printf("\n");
@@ -277,69 +936,138 @@ choose_DB_visual( /* Input */         Display *dpy, Bool listVis, int visclass,
 }
 
 static
-void main_loop(void)
+void main_loop(DizzyWindow *w)
 {
-    fd_set         select_mask;
-    int            fd;
-    struct timeval timeout;
-    int            new_event;
-    int            pending;
+    EventLoop      events;
+    int            ready[EVENT_LOOP_FDS];
+    int            fd, i, n;
+    int64_t        now, wait, deadline;
+    Bool           throttled = False;
+    Bool           ticked;
+    Bool           waited = False;
+    int64_t        wait_begin = 0;
+    unsigned long  delayed = 0;
+    Bool           probe;
     Bool           done = False;
 
-    fd = XConnectionNumber(dpy);
-    FD_ZERO(&select_mask);
-    FD_SET(fd, &select_mask);
+    fd = XConnectionNumber(w->dpy);
+    event_loop_init(&events);
+    event_loop_watch(&events, fd);
+    if (control.fd >= 0)
+        event_loop_watch(&events, control.fd);
+    frame_clock_init(&w->clock, fps, catchup);
+    w->begin = dizzy_now_ns();
 
     while (!done) {
         XEvent event;
 
+        check_dump_request();
+
         /* When we print we only render on Expose events and bump
          * |rotation| when the page number changes */                 
-        if (!paused && !manual_paused) {
-            pending = XEventsQueued(dpy, QueuedAfterFlush);
-            if (pending == 0) {
-                do {
-                    FD_ZERO(&select_mask);
-                    FD_SET(fd, &select_mask);
-                    timeout.tv_sec  = 0;
-                    timeout.tv_usec = 2000000./speed;
-                    new_event = select(fd + 1, &select_mask, NULL, NULL, &timeout);
-
-                    /* This isn't good - we should check the time stamps
-                     * between two frames to get a stable frame rate */
-                    if (new_event == 0) {
-                      rotation = rotation + delta;
-                      redraw();
-                      XFlush(dpy);
-                    }
-                } while (new_event == 0);
+        deadline = 0;
+        ticked   = False;
+        if (!w->paused && !w->manual_paused) {
+            now  = dizzy_now_ns();
+#ifdef HAVE_XTEST
+            if (latency_probes > 0 && w->clock.frames > 0) {
+                if (w->probe.count >= latency_probes)
+                    break;      /* all probes done */
+                latency_inject(&w->probe, w->dpy, w->win,
+                               w->winrect.width, w->winrect.height, now);
+            }
+#endif
+            wait = frame_clock_timeout(&w->clock, now);
+            /* The server still has enough frames queued: wait for the
+             * AlarmNotify or Present event that tells us it has caught
+             * up */
+            throttled = (wait <= 0 && !frame_lag_ready(&w->lag));
+#ifdef HAVE_PRESENT
+            throttled = throttled ||
+                        (wait <= 0 && backend == BACKEND_PRESENT && !present_ready());
+#endif
+            if (throttled) {
+                if (!waited)
+                    wait_begin = now;
+                waited = True;
+            }
+            else if (wait <= 0) {
+                /* The time spent waiting for the server counts towards
+                 * the cost of the frame for -lod */
+                int64_t begin = waited ? wait_begin : now;
+
+                if (waited)
+                    delayed++;
+                waited = False;
+                ticked = True;
+                /* Advance by elapsed time, not by frame count, so late
+                 * or skipped frames do not slow down the animation */
+                w->rotation = w->rotation + w->delta * frame_clock_tick(&w->clock, now);
+                if (!lod_skip_frame(&w->lod, w->clock.ticks)) {
+                    frame_stats_begin(&w->stats, w->dpy);
+                    redraw(w);
+                    w->clock.frames++;
+                    frame_stats_end(&w->stats, w->dpy, core_draw_list(w));
+                    if (lod_update(&w->lod, dizzy_now_ns() - begin))
+                        log_lod(w);
+                }
+            }
+            else {
+                deadline = now + wait;
+            }
+        }
+        else {
+            frame_clock_reset(&w->clock);
+        }
+
+        /* Only take an event if one is queued.  Otherwise go back and
+         * check the frame deadline right after a frame, or sleep until
+         * the deadline, an event or a control command; without a
+         * deadline (throttled or paused) until one of the latter two. */
+        if (XEventsQueued(w->dpy, QueuedAfterFlush) == 0) {
+            if (ticked)
+                continue;
+            n = event_loop_wait(&events, deadline, ready, EVENT_LOOP_FDS);
+            for (i = 0; i < n; i++) {
+                if (ready[i] != fd &&
+                    control_handle(&control, &events, ready[i]) && quitting())
+                    done = True;
             }
+            continue;
         }
 
-        XNextEvent(dpy, &event);
+        XNextEvent(w->dpy, &event);
+        if (frame_lag_handle_event(&w->lag, &event))
+            continue;
+        if (backend == BACKEND_SHM && raster_handle_event(&event))
+            continue;
+#ifdef HAVE_PRESENT
+        if (backend == BACKEND_PRESENT && present_handle_event(&event))
+            continue;
+#endif
 
 	switch (event.type) {
                 case MapNotify:
                     Log(("MapNotify: resuming...\n"));
-                    paused = False;
+                    w->paused = False;
                     break;
                 case UnmapNotify:
                     Log(("UnmapNotify: pausing...\n"));
-                    paused = True;
+                    w->paused = True;
                     break;
                 case VisibilityNotify:
                     switch (event.xvisibility.state) {
                     case VisibilityUnobscured:
                         Log(("VisibilityUnobscured: resuming...\n"));
-                        paused = False;
+                        w->paused = False;
                         break;
                     case VisibilityPartiallyObscured:
                         Log(("VisibilityPartiallyObscured: resuming...\n"));
-                        paused = False;
+                        w->paused = False;
                         break;
                     case VisibilityFullyObscured:
                         Log(("VisibilityFullyObscured: pausing...\n"));
-                        paused = True;
+                        w->paused = True;
                         break;
                     }
                     break;
@@ -347,83 +1075,712 @@ void main_loop(void)
                     Log(("Expose: rendering.\n"));
 
                     /* Swallow any extra Expose events */
-                    while (XCheckTypedEvent(dpy, Expose, &event))
+                    while (XCheckTypedEvent(w->dpy, Expose, &event))
                         ;
 
-                    redraw();
+                    redraw(w);
                     break;
                 case ButtonPress:
+                    /* Clicks of -latency change |delta| without a word */
+                    probe = False;
+#ifdef HAVE_XTEST
+                    probe = (latency_probes > 0 &&
+                             latency_input(&w->probe, dizzy_now_ns()));
+#endif
                     switch (event.xbutton.button) {
                         case 1:
-                            Msg(("ButtonPress: faster: %g\n", delta));
-                            delta += 0.005;
+                            if (!probe)
+                                Msg(("ButtonPress: faster: %g\n", w->delta));
+                            w->delta += 0.005;
                             break;
                         case 2:
-                            Msg(("ButtonPress: slower: %g\n", delta));
-                            delta += -0.005;
+                            if (!probe)
+                                Msg(("ButtonPress: slower: %g\n", w->delta));
+                            w->delta += -0.005;
                             break;
                         case 3:
-                            if (manual_paused) {
+                            if (w->manual_paused) {
                                 Msg(("ButtonPress: manual resume.\n"));
-                                manual_paused = False;
+                                w->manual_paused = False;
                             } else {
                                 Msg(("ButtonPress: manual pause.\n"));
-                                manual_paused = True;
+                                w->manual_paused = True;
                             }
                     }
                     break;
                 case KeyPress:
                     Msg(("KeyPress: done.\n"));
                     done = True;
+                    if (num_windows > 1)
+                        quit_all(w);
+                    break;
+                case ClientMessage:
+                    /* Sent by quit_all() from another window's thread */
+                    if (quitting())
+                        done = True;
                     break;
                 case ConfigureNotify:
+                    /* Only the last of a burst of resizes matters */
+                    while (XCheckTypedWindowEvent(w->dpy, w->win,
+                                                  ConfigureNotify, &event))
+                        ;
                     Log(("ConfigureNotify: resizing.\n"));
-                    winrect.width  = event.xconfigure.width;
-                    winrect.height = event.xconfigure.height;
+                    set_window_size(w, event.xconfigure.width, event.xconfigure.height);
                     break;
         }
     }
+
+    event_loop_fini(&events);
+    w->end    = dizzy_now_ns();
+    w->frames = w->clock.frames;
+    Log(("%lu frames, %lu late, %lu skipped, %lu waited for the server.\n",
+         w->clock.frames, w->clock.late, w->clock.skipped, delayed));
+    if (use_lod) {
+        Log(("Detail level %d at exit, %lu level changes.\n",
+             w->lod.level, w->lod.changes));
+    }
+#ifdef HAVE_PRESENT
+    if (verbose && backend == BACKEND_PRESENT)
+        present_report(stdout);
+#endif
+#ifdef HAVE_XTEST
+    if (latency_probes > 0)
+        latency_report(stdout, ProgramName, &w->probe);
+#endif
 }
 
 
-int main(int argc, char *argv[])
+/* Handle |event| while benchmarking: only size changes matter, nobody
+ * is watching */
+static
+void bench_event(DizzyWindow *w, XEvent *event)
 {
-    int                  i;
-    XSetWindowAttributes attrs;
-    Visual              *visual;
-    Colormap             cmap;
-    XGCValues            gcvals;
-    Bool                 use_threadsafe_api = True;
+    if (backend == BACKEND_SHM && raster_handle_event(event))
+        return;
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT && present_handle_event(event))
+        return;
+#endif
+    if (event->type == ConfigureNotify) {
+        set_window_size(w, event->xconfigure.width, event->xconfigure.height);
+    }
+}
 
-    ProgramName = argv[0];
+/* Wait until the window is mapped and exposed */
+static
+void wait_exposed(DizzyWindow *w)
+{
+    XEvent event;
 
-    for (i = 1; i < argc; i++) {
-        char *arg;
+    do {
+        XNextEvent(w->dpy, &event);
+        bench_event(w, &event);
+    } while (event.type != Expose);
+    w->exposed = dizzy_now_ns();
+}
 
-        arg = argv[i];
-        if (!strcmp(arg, "-display")) {
-            if (++i >= argc) {
-                fprintf(stderr, "%s: Missing argument to -display\n", ProgramName);
-                exit(EXIT_FAILURE);
-            }
-            display_name = argv[i];
+/*
+ * Render |bench_frames| frames without any user interaction and record
+ * frame time statistics for report_benchmark().  Each frame is completed with an XSync() round
+ * trip, so the frame time includes the server side rendering and swap;
+ * with Present it includes the wait for the vertical blank as well.
+ */
+static
+void benchmark_loop(DizzyWindow *w)
+{
+    FrameTimes    *times = &w->times;
+    FrameClock     clock;
+    XEvent         event;
+    struct timeval timeout;
+    int64_t        t0, t1, t2, t3, wait;
+    int64_t        captured = 0;
+    int            n;
+
+    if (!frame_times_init(times, bench_frames)) {
+        fprintf(stderr, "%s: Cannot allocate %d frame samples.\n",
+                ProgramName, bench_frames);
+        exit(EXIT_FAILURE);
+    }
+
+    wait_exposed(w);
+    if (capture_path != NULL &&
+        !capture_open(w->dpy, w->win, capture_path, bench_frames, w->delta))
+        exit(EXIT_FAILURE);
+
+    frame_clock_init(&clock, fps, catchup);
+    times->begin = dizzy_now_ns();
+
+    for (n = 0; n < bench_frames; n++) {
+        while ((wait = frame_clock_timeout(&clock, dizzy_now_ns())) > 0) {
+            wait = (wait + 999) / 1000;
+            timeout.tv_sec  = wait / 1000000;
+            timeout.tv_usec = wait % 1000000;
+            select(0, NULL, NULL, NULL, &timeout);
         }
-        else if (!strcmp(arg, "-delta")) {
-            if (++i >= argc)
-                usage();
-            errno = 0; /* reset errno to catch |atof()|-errors */
-            delta = atof(argv[i]);
-            if (errno != 0)
-                usage();
+
+        while (XPending(w->dpy)) {
+            XNextEvent(w->dpy, &event);
+            bench_event(w, &event);
         }
-        else if (!strcmp(arg, "-class")) {
-            arg = argv[++i];
-            if (arg == NULL) {
-                fprintf(stderr, "%s: Missing argument to -class\n", ProgramName);
-                exit(EXIT_FAILURE);
-            }
-            if ((!strcmp(arg, "TrueColor")) || (!strcmp(arg, "True")))
-                visclass = TrueColor;
+        /* Every frame of a benchmark should take the same path, so a
+         * size change does not turn off the ring cache for a while */
+        w->resized = 0;
+
+        check_dump_request();
+
+        t0 = dizzy_now_ns();
+        w->rotation = w->rotation + w->delta * frame_clock_tick(&clock, t0);
+        if (capture_path != NULL) {
+            /* The same frames on every server, however fast it is */
+            w->rotation = w->delta * n;
+        }
+        frame_stats_begin(&w->stats, w->dpy);
+        draw_scene(w);
+        t1 = dizzy_now_ns();
+        swap_buffers(w);
+        t2 = dizzy_now_ns();
+        /* Only the flush is part of the frame; the byte estimate and
+         * XSync probe of -stats would count as server time */
+        frame_stats_flush(&w->stats, w->dpy);
+        finish_frame(w);
+        t3 = dizzy_now_ns();
+        frame_stats_end(&w->stats, w->dpy, core_draw_list(w));
+
+        frame_times_add(times, t1 - t0, t2 - t1, t3 - t2);
+        if (time_startup && w->first_frame == 0)
+            report_startup(w);
+        if (record_path != NULL) {
+            trace_record_frame(&w->drawlist, w->winrect.width,
+                               w->winrect.height, t0);
+        }
+        if (capture_path != NULL) {
+            capture_frame();
+            captured += dizzy_now_ns() - t3;
+        }
+    }
+    /* The capture is reported on its own */
+    times->end = dizzy_now_ns() - captured;
+}
+
+/* The sizes -resizebench steps through; the last one goes back down,
+ * where the back buffer shrinks instead of growing */
+static const struct {
+    int width, height;
+} resize_sizes[] = {
+    {  200,  200 }, {  400,  300 }, {  640,  480 }, {  800,  600 },
+    { 1024,  768 }, { 1280, 1024 }, {  400,  400 }
+};
+
+/* Resize the window to |width| x |height| and wait until the server
+ * says it has the new size, or RESIZE_TIMEOUT for a window manager that
+ * grants another one */
+static
+void resize_and_wait(DizzyWindow *w, int width, int height)
+{
+    int64_t   end = dizzy_now_ns() + RESIZE_TIMEOUT;
+    EventLoop events;
+    XEvent    event;
+    int       ready;
+
+    XResizeWindow(w->dpy, w->win, width, height);
+    XFlush(w->dpy);
+
+    event_loop_init(&events);
+    event_loop_watch(&events, ConnectionNumber(w->dpy));
+    while (w->winrect.width != width || w->winrect.height != height) {
+        if (XPending(w->dpy)) {
+            XNextEvent(w->dpy, &event);
+            bench_event(w, &event);
+            continue;
+        }
+        if (dizzy_now_ns() >= end)
+            break;
+        event_loop_wait(&events, end, &ready, 1);
+    }
+    event_loop_fini(&events);
+}
+
+/*
+ * Step the window through resize_sizes[] with XResizeWindow() and render
+ * |resize_frames| frames at every size, each completed like a
+ * -benchmark frame.  The first frame after a resize pays for the new
+ * back buffer and ring cache, so it is reported apart from the mean of
+ * the others.
+ */
+static
+void resize_bench_loop(DizzyWindow *w)
+{
+    int64_t t0, t1, t2, t3;
+    double  draw, swap, server;
+    int     s, n;
+
+    wait_exposed(w);
+
+    for (s = 0; s < (int) (sizeof(resize_sizes) / sizeof(resize_sizes[0])); s++) {
+        resize_and_wait(w, resize_sizes[s].width, resize_sizes[s].height);
+        /* A scripted size is final, there is no point in waiting for it
+         * to settle */
+        w->resized = 0;
+
+        draw = swap = server = 0.;
+        for (n = 0; n < resize_frames; n++) {
+            t0 = dizzy_now_ns();
+            w->rotation += w->delta;
+            draw_scene(w);
+            t1 = dizzy_now_ns();
+            swap_buffers(w);
+            t2 = dizzy_now_ns();
+            finish_frame(w);
+            t3 = dizzy_now_ns();
+
+            if (n == 0) {
+                printf("%s: %4dx%-4d first frame  draw %8.3f ms  swap %8.3f ms"
+                       "  server %8.3f ms\n", ProgramName,
+                       w->winrect.width, w->winrect.height,
+                       (t1 - t0) / 1e6, (t2 - t1) / 1e6, (t3 - t2) / 1e6);
+                continue;
+            }
+            draw   += (t1 - t0) / 1e6;
+            swap   += (t2 - t1) / 1e6;
+            server += (t3 - t2) / 1e6;
+        }
+        if (resize_frames > 1) {
+            n = resize_frames - 1;
+            printf("%s: %4dx%-4d mean of %-5d draw %8.3f ms  swap %8.3f ms"
+                   "  server %8.3f ms\n", ProgramName,
+                   w->winrect.width, w->winrect.height, n,
+                   draw / n, swap / n, server / n);
+        }
+    }
+}
+
+/*
+ * Send the frames of the -replay trace to the server, each completed
+ * like a -benchmark frame and recorded in the same statistics.  Nothing
+ * is computed on the client; with -replaytimed every frame waits for
+ * its recorded time, else they go out back to back.
+ */
+static
+void replay_loop(DizzyWindow *w)
+{
+    FrameTimes    *times = &w->times;
+    XEvent         event;
+    struct timeval timeout;
+    int64_t        t0, t1, t2, t3, at, wait;
+    int            width, height;
+
+    if (!frame_times_init(times, replay_frames)) {
+        fprintf(stderr, "%s: Cannot allocate %d frame samples.\n",
+                ProgramName, replay_frames);
+        exit(EXIT_FAILURE);
+    }
+
+    wait_exposed(w);
+    times->begin = dizzy_now_ns();
+
+    while (trace_replay_next(&at, &width, &height)) {
+        while (replay_timed &&
+               (wait = times->begin + at - dizzy_now_ns()) > 0) {
+            wait = (wait + 999) / 1000;
+            timeout.tv_sec  = wait / 1000000;
+            timeout.tv_usec = wait % 1000000;
+            select(0, NULL, NULL, NULL, &timeout);
+        }
+
+        while (XPending(w->dpy)) {
+            XNextEvent(w->dpy, &event);
+            bench_event(w, &event);
+        }
+        /* The frame was recorded at this size; waiting for the server
+         * to apply it is not part of the frame */
+        if (width != w->winrect.width || height != w->winrect.height)
+            resize_and_wait(w, width, height);
+
+        t0 = dizzy_now_ns();
+        if (!do_db || swap_action != XdbeBackground) {
+            XFillRectangle(w->dpy, w->buf, w->gcs[COLOR_BACKGROUND], 0, 0,
+                           w->winrect.width, w->winrect.height);
+        }
+        trace_replay_emit(w->dpy, w->buf, w->gcs);
+        t1 = dizzy_now_ns();
+        swap_buffers(w);
+        t2 = dizzy_now_ns();
+        finish_frame(w);
+        t3 = dizzy_now_ns();
+        frame_times_add(times, t1 - t0, t2 - t1, t3 - t2);
+        if (time_startup && w->first_frame == 0)
+            report_startup(w);
+    }
+    times->end = dizzy_now_ns();
+}
+
+static
+void report_benchmark(DizzyWindow *w)
+{
+    char prefix[128];
+
+    window_prefix(w, prefix, sizeof(prefix));
+
+    fprintf(stdout, "%s: startup to first Expose: %.3f ms\n",
+            prefix, (w->exposed - startup_begin) / 1e6);
+    frame_times_report(stdout, prefix, &w->times);
+    if (capture_path != NULL)
+        capture_close(stdout, prefix);
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT)
+        present_report(stdout);
+#endif
+    frame_times_free(&w->times);
+}
+
+/* Frames of the windows on the |display|th display, or of all windows
+ * if it is < 0, from the first start to the last end */
+static
+void report_total(int display)
+{
+    unsigned long frames = 0;
+    int64_t       begin = 0, end = 0;
+    int           i, n = 0;
+
+    for (i = 0; i < num_windows; i++) {
+        DizzyWindow *w = &windows[i];
+
+        if (display >= 0 && w->display != display)
+            continue;
+        frames += w->frames;
+        if (n == 0 || w->begin < begin)
+            begin = w->begin;
+        if (n == 0 || w->end > end)
+            end = w->end;
+        n++;
+    }
+    if (display >= 0)
+        fprintf(stdout, "%s: display %s: ", ProgramName,
+                display_names[display]);
+    else
+        fprintf(stdout, "%s: ", ProgramName);
+    fprintf(stdout, "%d windows: %lu frames in %.3f s, %.1f frames/s\n",
+            n, frames, (end - begin) / 1e9,
+            (end > begin) ? frames / ((end - begin) / 1e9) : 0.);
+}
+
+/* Frame rate of every window, of every display and of all of them
+ * together */
+static
+void report_windows(void)
+{
+    char prefix[128];
+    int  i;
+
+    for (i = 0; i < num_windows; i++) {
+        DizzyWindow *w = &windows[i];
+        double       seconds;
+
+        if (bench_frames > 0) {
+            w->begin  = w->times.begin;
+            w->end    = w->times.end;
+            w->frames = w->times.count;
+            report_benchmark(w);
+        }
+        else {
+            window_prefix(w, prefix, sizeof(prefix));
+            seconds = (w->end - w->begin) / 1e9;
+            fprintf(stdout, "%s: %lu frames in %.3f s, %.1f frames/s\n",
+                    prefix, w->frames, seconds,
+                    (seconds > 0.) ? w->frames / seconds : 0.);
+        }
+    }
+    if (num_displays > 1) {
+        for (i = 0; i < num_displays; i++)
+            report_total(i);
+    }
+    report_total(-1);
+}
+
+/* Open the connection, window, back buffer and GCs of |w| and map it */
+static
+void open_window(DizzyWindow *w, int argc, char *argv[])
+{
+    int                  i;
+    XSetWindowAttributes attrs;
+    Visual              *visual;
+    Colormap             cmap;
+    XGCValues            gcvals;
+
+    w->opened = dizzy_now_ns();
+    scene_lists_init(&w->scene, &scene, use_cull);
+    w->drawlist.line_width = scene.line_width;
+    w->delta = delta;
+
+    w->dpy = XOpenDisplay(display_names[w->display]);
+    if (w->dpy == NULL) {
+        fprintf(stderr, "%s: Cannot open display %s\n",
+                ProgramName, XDisplayName(display_names[w->display]));
+        exit(EXIT_FAILURE);
+    }
+
+    if (synchronous) {
+        Log(("Running in synchronous X mode.\n"));
+        XSynchronize(w->dpy, True);
+    }
+
+    w->screen = XDefaultScreenOfDisplay(w->dpy);
+    w->screennum = XScreenNumberOfScreen(w->screen);
+
+    /* Cascade the windows of -windows on each display */
+    w->winrect.x      = 10 + 20 * (w->index / num_displays % 16);
+    w->winrect.y      = 10 + 20 * (w->index / num_displays % 16);
+    w->winrect.width  = 400;
+    w->winrect.height = 400;
+    if (replay_path != NULL) {
+        /* The size of the first recorded frame */
+        w->winrect.width  = replay_width;
+        w->winrect.height = replay_height;
+    }
+    w->connected = dizzy_now_ns();
+
+    if (do_db) {
+        int dbeMajorVersion,
+            dbeMinorVersion;
+
+        if (!XdbeQueryExtension (w->dpy, &dbeMajorVersion, &dbeMinorVersion)) {
+            fprintf(stderr, "%s: XdbeQueryExtension() failed.\n", ProgramName);
+            exit(EXIT_FAILURE);
+        }
+
+        /* -list needs the answer of the server */
+        visual = NULL;
+        if (use_visual_cache && !listVis) {
+            visual = visual_cache_lookup(w->dpy, w->screennum, visclass,
+                                         depth, visid, &w->depth);
+            w->visual_cached = (visual != NULL);
+        }
+        if (visual == NULL) {
+            w->depth = depth;
+            visual = choose_DB_visual(w->dpy, listVis && w->index == 0,
+                                      visclass, &w->depth);
+            if (visual != NULL && use_visual_cache) {
+                visual_cache_store(w->dpy, w->screennum, visclass, depth,
+                                   visid, visual, w->depth);
+            }
+        }
+        if (visual == NULL) {
+            fprintf(stderr, "%s: Failed to find matching double buffer capable visual.\n", ProgramName);
+            exit(EXIT_FAILURE);
+        }
+        /* The first window of each display */
+        if (w->index < num_displays) {
+            char prefix[128];
+
+            window_prefix(w, prefix, sizeof(prefix));
+            fprintf(stdout, "%s: Chose visual ID: %#4x depth: %d\n\n",
+                    num_displays > 1 ? prefix : ProgramName,
+                    (int)visual->visualid, w->depth);
+        }
+    }
+    else {
+        /* No double buffering: ignore class, depth; use default visual. */
+        visual = XDefaultVisual(w->dpy, w->screennum);
+        w->depth  = XDefaultDepth(w->dpy,  w->screennum);
+    }
+
+    w->visual_chosen = dizzy_now_ns();
+
+    cmap = XCreateColormap(w->dpy, XRootWindowOfScreen(w->screen), visual, AllocNone);
+    if (!alloc_colors(w->dpy, visual, cmap, scene.colors, scene.ncolors,
+                      w->pixels)) {
+        exit(EXIT_FAILURE);
+    }
+    w->colors_done = dizzy_now_ns();
+    attrs.colormap         = cmap;
+    attrs.background_pixel = w->pixels[COLOR_BACKGROUND];
+    attrs.border_pixel     = w->pixels[COLOR_BACKGROUND];
+    w->win = XCreateWindow(w->dpy, XRootWindowOfScreen(w->screen), 
+                           w->winrect.x, w->winrect.y, w->winrect.width, w->winrect.height,
+                           0, w->depth, InputOutput, visual,
+                           CWBorderPixel | CWColormap | CWBackPixel, &attrs);
+    if (w->win == None) {
+        fprintf(stderr, "%s: Couldn't window.\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+
+    XSetStandardProperties(w->dpy, w->win, "DBE dizzy demo", ProgramName, None,
+                           argv, argc, NULL);
+    XSelectInput(w->dpy, w->win,
+                 VisibilityChangeMask | ExposureMask | ButtonPressMask | KeyPressMask |
+                 StructureNotifyMask);
+    if (do_db) {
+        w->swapInfo.swap_action = swap_action;
+        w->buf = XdbeAllocateBackBufferName (w->dpy, w->win, w->swapInfo.swap_action);
+        if (w->buf == None) {
+            fprintf(stderr, "%s: Couldn't create buffers\n", ProgramName);
+            exit(EXIT_FAILURE);
+        }
+        else {
+            w->swapInfo.swap_window = w->win;
+            if (w->index == 0)
+                Log(("Swap action: %s.\n", swap_action_names[swap_action]));
+        }
+    }
+    else {
+        w->buf = w->win; /* No double buffering. */
+    }
+
+    /* Create GCs, one per color (to avoid pipeline flushing
+     * when the GC is changed) */
+    gcvals.line_width = scene.line_width;
+    
+    gcvals.cap_style  = CapRound;
+#define CREATECOLORGC(cl) (gcvals.foreground = (cl), \
+                           XCreateGC(w->dpy, w->win, GCForeground | GCLineWidth | GCCapStyle, &gcvals))
+    for (i = 0; i < scene.ncolors; i++) {
+        w->gcs[i] = CREATECOLORGC(w->pixels[i]);
+    }
+#undef CREATECOLORGC
+
+    if (backend == BACKEND_SHM && !raster_init(w->dpy, visual, w->depth)) {
+        exit(EXIT_FAILURE);
+    }
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT && !present_init(w->dpy, w->win, w->depth)) {
+        exit(EXIT_FAILURE);
+    }
+#endif
+#ifdef HAVE_XRENDER
+    if (backend == BACKEND_RENDER &&
+        !render_init(w->dpy, visual, cmap, w->pixels, scene.ncolors)) {
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    frame_lag_init(&w->lag, w->dpy, max_lag);
+#ifdef HAVE_XTEST
+    if (latency_probes > 0 && !latency_init(&w->probe, w->dpy, latency_probes)) {
+        exit(EXIT_FAILURE);
+    }
+#endif
+    lod_init(&w->lod, use_lod ? (int64_t) (1e9 / fps) : 0);
+
+    XMapWindow(w->dpy, w->win);
+    w->mapped = dizzy_now_ns();
+}
+
+static
+void close_window(DizzyWindow *w)
+{
+    invalidate_ring_cache(w);
+    frame_lag_fini(&w->lag);
+#ifdef HAVE_XTEST
+    if (latency_probes > 0)
+        latency_fini(&w->probe);
+#endif
+    if (backend == BACKEND_SHM)
+        raster_fini();
+#ifdef HAVE_PRESENT
+    if (backend == BACKEND_PRESENT)
+        present_fini();
+#endif
+#ifdef HAVE_XRENDER
+    if (backend == BACKEND_RENDER)
+        render_fini();
+#endif
+    XDestroyWindow(w->dpy, w->win);
+    XCloseDisplay(w->dpy);
+    draw_list_free(&w->drawlist);
+    scene_lists_free(&w->scene);
+}
+
+static
+void *window_thread(void *arg)
+{
+    DizzyWindow *w = arg;
+
+    w->cpu = pin_threads ? pin_thread(w->index) : -1;
+    if (pin_threads && w->cpu < 0)
+        fprintf(stderr, "%s: Cannot bind the thread of window %d to a CPU.\n",
+                ProgramName, w->index);
+    else if (pin_threads)
+        Log(("Window %d runs on CPU %d.\n", w->index, w->cpu));
+
+    if (bench_frames > 0)
+        benchmark_loop(w);
+    else if (resize_frames > 0)
+        resize_bench_loop(w);
+    else if (replay_path != NULL)
+        replay_loop(w);
+    else
+        main_loop(w);
+    return (NULL);
+}
+
+
+/* Split the comma separated list of -display into |display_names| */
+static
+void split_displays(void)
+{
+    char *p, *next;
+    int   n = 1;
+
+    for (p = display_name; p != NULL && *p != '\0'; p++) {
+        if (*p == ',')
+            n++;
+    }
+    display_names = calloc(n, sizeof(char *));
+    if (display_names == NULL) {
+        fprintf(stderr, "%s: Cannot allocate %d display names.\n",
+                ProgramName, n);
+        exit(EXIT_FAILURE);
+    }
+    if (display_name == NULL) {
+        /* XOpenDisplay() falls back to $DISPLAY */
+        num_displays = 1;
+        return;
+    }
+    num_displays = 0;
+    for (p = strtok_r(display_name, ",", &next); p != NULL;
+         p = strtok_r(NULL, ",", &next))
+        display_names[num_displays++] = p;
+    if (num_displays == 0) {
+        fprintf(stderr, "%s: No display in the -display list\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int                  i;
+    Bool                 use_threadsafe_api = True;
+
+    ProgramName = argv[0];
+    startup_begin = dizzy_now_ns();
+
+    for (i = 1; i < argc; i++) {
+        char *arg;
+
+        arg = argv[i];
+        if (!strcmp(arg, "-display")) {
+            if (++i >= argc) {
+                fprintf(stderr, "%s: Missing argument to -display\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            display_name = argv[i];
+        }
+        else if (!strcmp(arg, "-delta")) {
+            if (++i >= argc)
+                usage();
+            errno = 0; /* reset errno to catch |atof()|-errors */
+            delta = atof(argv[i]);
+            if (errno != 0)
+                usage();
+        }
+        else if (!strcmp(arg, "-class")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -class\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            if ((!strcmp(arg, "TrueColor")) || (!strcmp(arg, "True")))
+                visclass = TrueColor;
             else if (!strcmp(arg, "DirectColor"))
                 visclass = DirectColor;
             else if ((!strcmp(arg, "PseudoColor")) || (!strcmp(arg, "Pseudo")))
@@ -459,6 +1816,171 @@ int main(int argc, char *argv[])
             speed = atof(argv[i]);
             if (errno != 0)
                 usage();
+        } else if (!strcmp(arg, "-fps")) {
+            if (++i >= argc)
+                usage();
+            errno = 0; /* reset errno to catch |atof()|-errors */
+            fps = atof(argv[i]);
+            if (errno != 0 || fps < 0.)
+                usage();
+        } else if (!strcmp(arg, "-catchup")) {
+            catchup = True;
+        } else if (!strcmp(arg, "-benchmark")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -benchmark\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            bench_frames = atoi(arg);
+            if (errno != 0 || bench_frames <= 0)
+                usage();
+        } else if (!strcmp(arg, "-capture")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -capture\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            capture_path = arg;
+        } else if (!strcmp(arg, "-record")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -record\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            record_path = arg;
+        } else if (!strcmp(arg, "-replay")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -replay\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            replay_path = arg;
+        } else if (!strcmp(arg, "-replaytimed")) {
+            replay_timed = True;
+        } else if (!strcmp(arg, "-resizebench")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -resizebench\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            resize_frames = atoi(arg);
+            if (errno != 0 || resize_frames <= 0)
+                usage();
+        } else if (!strcmp(arg, "-latency")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -latency\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            latency_probes = atoi(arg);
+            if (errno != 0 || latency_probes <= 0)
+                usage();
+        } else if (!strcmp(arg, "-kernelbench")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -kernelbench\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            kernel_frames = atoi(arg);
+            if (errno != 0 || kernel_frames <= 0)
+                usage();
+        } else if (!strcmp(arg, "-cpubench")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -cpubench\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            cpu_frames = atoi(arg);
+            if (errno != 0 || cpu_frames <= 0)
+                usage();
+        } else if (!strcmp(arg, "-backend")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -backend\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            for (backend = 0; backend < NUM_BACKENDS; backend++) {
+                if (!strcmp(arg, backend_names[backend]))
+                    break;
+            }
+            if (backend == NUM_BACKENDS || !backend_built[backend]) {
+                fprintf(stderr, "%s: Unsupported backend %s\n", ProgramName, arg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strcmp(arg, "-windows")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -windows\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            num_windows = atoi(arg);
+            if (errno != 0 || num_windows <= 0)
+                usage();
+        } else if (!strcmp(arg, "-pin")) {
+            pin_threads = True;
+        } else if (!strcmp(arg, "-scene")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -scene\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            scene_file = arg;
+        } else if (!strcmp(arg, "-control")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -control\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            control_path = arg;
+        } else if (!strcmp(arg, "-stats")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -stats\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            stats_file = arg;
+        } else if (!strcmp(arg, "-statsformat")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -statsformat\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            if (!strcmp(arg, "csv"))
+                stats_format = STATS_CSV;
+            else if (!strcmp(arg, "json"))
+                stats_format = STATS_JSON;
+            else {
+                fprintf(stderr, "%s: Wrong argument %s for -statsformat\n", ProgramName, arg);
+                exit(EXIT_FAILURE);
+            }
+        } else if (!strcmp(arg, "-statssync")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -statssync\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            stats_sync = atoi(arg);
+            if (errno != 0 || stats_sync < 0)
+                usage();
+        } else if (!strcmp(arg, "-maxlag")) {
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -maxlag\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            errno = 0; /* reset errno to catch |atoi()|-errors */
+            max_lag = atoi(arg);
+            if (errno != 0 || max_lag < 0)
+                usage();
+        } else if (!strcmp(arg, "-lod")) {
+            use_lod = True;
         } else if (!strcmp(arg, "-spokes")) {
             arg = argv[++i];
             if (arg == NULL) {
@@ -471,6 +1993,31 @@ int main(int argc, char *argv[])
                 usage();
         } else if (!strcmp(arg, "-nodb")) {
             do_db = False;
+        } else if (!strcmp(arg, "-noringcache")) {
+            use_ring_cache = False;
+        } else if (!strcmp(arg, "-nocull")) {
+            use_cull = False;
+        } else if (!strcmp(arg, "-novisualcache")) {
+            use_visual_cache = False;
+        } else if (!strcmp(arg, "-timestartup")) {
+            time_startup = True;
+        } else if (!strcmp(arg, "-swapaction")) {
+            int a;
+
+            arg = argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: Missing argument to -swapaction\n", ProgramName);
+                exit(EXIT_FAILURE);
+            }
+            for (a = 0; a < 4; a++) {
+                if (!strcmp(arg, swap_action_names[a]))
+                    break;
+            }
+            if (a == 4) {
+                fprintf(stderr, "%s: Wrong argument %s for -swapaction\n", ProgramName, arg);
+                exit(EXIT_FAILURE);
+            }
+            swap_action = a;
         } else if (!strcmp(arg, "-visid")) {
             arg = argv[++i];
             if (arg == NULL) {
@@ -492,119 +2039,241 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (use_threadsafe_api) {
-        if (!XInitThreads()) {
-            fprintf(stderr, "%s: XInitThreads() failure.\n", ProgramName);
+    if (kernel_frames > 0) {
+        spoke_geometry_bench(stdout, spokes, kernel_frames);
+        exit(EXIT_SUCCESS);
+    }
+    if (cpu_frames > 0) {
+        if (!frame_bench(stdout, scene_file, cpu_frames, use_cull))
             exit(EXIT_FAILURE);
-        }
+        exit(EXIT_SUCCESS);
     }
 
-    {
-        dpy = XOpenDisplay(display_name);
-        if (dpy == NULL) {
-            fprintf(stderr, "%s: Cannot open display %s\n",
-                    ProgramName, XDisplayName(display_name));
+    if (scene_file != NULL) {
+        if (!scene_load(&scene, scene_file, spokes))
             exit(EXIT_FAILURE);
-        }
+    }
+    else {
+        scene_default(&scene, spokes);
+    }
 
-        if (synchronous) {
-            Log(("Running in synchronous X mode.\n"));
-            XSynchronize(dpy, True);
-        }
+    if (backend == BACKEND_PRESENT) {
+        /* Present replaces DBE; the window uses the default visual */
+        do_db = False;
+    }
 
-        screen = XDefaultScreenOfDisplay(dpy);
-        screennum = XScreenNumberOfScreen(screen);
+    split_displays();
+    /* At least one window per display; the windows go round robin */
+    if (num_windows < num_displays)
+        num_windows = num_displays;
 
-        winrect.x      = 10;
-        winrect.y      = 10;
-        winrect.width  = 400;
-        winrect.height = 400;
+    /* The other backends keep per-connection state of their own */
+    if (num_windows > 1 && backend != BACKEND_XLIB) {
+        fprintf(stderr, "%s: -windows and display lists need the xlib backend\n", ProgramName);
+        exit(EXIT_FAILURE);
     }
-    
-    if (do_db) {
-        int dbeMajorVersion,
-            dbeMinorVersion;
 
-        if (!XdbeQueryExtension (dpy, &dbeMajorVersion, &dbeMinorVersion)) {
-            fprintf(stderr, "%s: XdbeQueryExtension() failed.\n", ProgramName);
-            exit(EXIT_FAILURE);
-        }
+    /* The xcb backend redraws whole frames in full detail, keeps no
+     * statistics, does not bound the frames in flight and chooses its
+     * visual without listing them */
+    if (backend == BACKEND_XCB &&
+        (swap_action == XdbeUntouched || swap_action == XdbeCopied ||
+         synchronous || stats_file != NULL || listVis || max_lag > 0 ||
+         use_lod)) {
+        fprintf(stderr, "%s: -swapaction untouched or copied, -sync, -stats, "
+                "-list, -maxlag and -lod need an Xlib based backend\n",
+                ProgramName);
+        exit(EXIT_FAILURE);
+    }
 
-        if ((visual = choose_DB_visual(dpy, listVis, visclass, &depth)) == NULL) {
-            fprintf(stderr, "%s: Failed to find matching double buffer capable visual.\n", ProgramName);
+    if (latency_probes > 0) {
+#ifndef HAVE_XTEST
+        fprintf(stderr, "%s: -latency needs XTEST support, which is not built in\n",
+                ProgramName);
+        exit(EXIT_FAILURE);
+#endif
+        /* The probes move the one pointer there is */
+        if (num_windows > 1 || bench_frames > 0 || backend == BACKEND_XCB) {
+            fprintf(stderr, "%s: -latency needs a single window, no -benchmark "
+                    "and not the xcb backend\n", ProgramName);
             exit(EXIT_FAILURE);
         }
-        fprintf(stdout, "%s: Chose visual ID: %#4x depth: %d\n\n",
-                ProgramName, (int)visual->visualid, depth);
     }
-    else {
-        /* No double buffering: ignore class, depth; use default visual. */
-        visual = XDefaultVisual(dpy, screennum);
-        depth  = XDefaultDepth(dpy,  screennum);
+
+    /* The capture follows the one window of -benchmark */
+    if (capture_path != NULL &&
+        (bench_frames == 0 || num_windows > 1 || backend == BACKEND_XCB)) {
+        fprintf(stderr, "%s: -capture needs -benchmark, a single window "
+                "and not the xcb backend\n", ProgramName);
+        exit(EXIT_FAILURE);
     }
 
-    cmap = XCreateColormap(dpy, XRootWindowOfScreen(screen), visual, AllocNone);
-    c_black  = getColor(cmap, "black");
-    c_pink   = getColor(cmap, "pink");
-    c_green  = getColor(cmap, "green");
-    c_orange = getColor(cmap, "orange");
-    c_blue   = getColor(cmap, "blue");
-    attrs.colormap         = cmap;
-    attrs.background_pixel = c_black;
-    attrs.border_pixel     = c_black;
-    win = XCreateWindow(dpy, XRootWindowOfScreen(screen), 
-                        winrect.x, winrect.y, winrect.width, winrect.height,
-                        0, depth, InputOutput, visual,
-                        CWBorderPixel | CWColormap | CWBackPixel, &attrs);
-    if (win == None) {
-        fprintf(stderr, "%s: Couldn't window.\n", ProgramName);
+    /* One trace, written or read by the one window */
+    if (record_path != NULL &&
+        (num_windows > 1 || replay_path != NULL || backend == BACKEND_XCB)) {
+        fprintf(stderr, "%s: -record needs a single window, no -replay "
+                "and not the xcb backend\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+    if (replay_path != NULL &&
+        (num_windows > 1 || bench_frames > 0 || resize_frames > 0 ||
+         latency_probes > 0 || control_path != NULL || use_lod ||
+         backend != BACKEND_XLIB)) {
+        fprintf(stderr, "%s: -replay needs a single window, the xlib backend "
+                "and none of -benchmark, -resizebench, -latency, -control "
+                "or -lod\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+    if (replay_timed && replay_path == NULL) {
+        fprintf(stderr, "%s: -replaytimed needs -replay\n", ProgramName);
         exit(EXIT_FAILURE);
     }
 
-    XSetStandardProperties(dpy, win, "DBE dizzy demo", ProgramName, None,
-                           argv, argc, NULL);
-    XSelectInput(dpy, win,
-                 VisibilityChangeMask | ExposureMask | ButtonPressMask | KeyPressMask |
-                 StructureNotifyMask);
-    if (do_db) {
-        swapInfo.swap_action = XdbeBackground;
-        buf = XdbeAllocateBackBufferName (dpy, win, swapInfo.swap_action);
-        if (buf == None) {
-            fprintf(stderr, "%s: Couldn't create buffers\n", ProgramName);
+    /* The report is about the one window being resized */
+    if (resize_frames > 0 &&
+        (num_windows > 1 || bench_frames > 0 || latency_probes > 0 ||
+         control_path != NULL || backend == BACKEND_XCB)) {
+        fprintf(stderr, "%s: -resizebench needs a single window, no -benchmark, "
+                "-latency or -control and not the xcb backend\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (time_startup && backend == BACKEND_XCB) {
+        fprintf(stderr, "%s: -timestartup needs an Xlib based backend\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The commands change settings all windows share */
+    if (control_path != NULL &&
+        (num_windows > 1 || bench_frames > 0 || backend == BACKEND_XCB)) {
+        fprintf(stderr, "%s: -control needs a single window, no -benchmark "
+                "and not the xcb backend\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+
+    if (fps < 0. && bench_frames > 0) {
+        /* Benchmarks run as fast as possible unless asked otherwise */
+        fps = 0.;
+    }
+    else if (fps < 0.) {
+        /* Historic meaning of -speed: delay between frames is 2sec/speed */
+        fps = speed / 2.;
+    }
+
+    if (use_lod && (fps <= 0. || bench_frames > 0)) {
+        fprintf(stderr, "%s: -lod needs a frame rate and no -benchmark\n", ProgramName);
+        exit(EXIT_FAILURE);
+    }
+    if (max_lag < 0) {
+        /* Without a limit the governor would not see the server lag */
+        max_lag = use_lod ? 2 : 0;
+    }
+
+    if (replay_path != NULL &&
+        !trace_replay_open(replay_path, &scene, &replay_frames,
+                           &replay_width, &replay_height)) {
+        exit(EXIT_FAILURE);
+    }
+    if (record_path != NULL) {
+        if (!trace_record_open(record_path, &scene))
+            exit(EXIT_FAILURE);
+        /* The trace has to hold everything a frame draws */
+        use_ring_cache = False;
+    }
+
+#ifdef HAVE_XCB
+    if (backend == BACKEND_XCB) {
+        DizzyOptions opts;
+
+        opts.display_name  = display_name;
+        opts.visclass      = visclass;
+        opts.depth         = depth;
+        opts.visid         = visid;
+        opts.do_db         = do_db;
+        opts.swap_action   = swap_action;
+        opts.ring_cache    = use_ring_cache;
+        opts.cull          = use_cull;
+        opts.scene         = &scene;
+        opts.delta         = delta;
+        opts.fps           = fps;
+        opts.catchup       = catchup;
+        opts.bench_frames  = bench_frames;
+        opts.startup_begin = startup_begin;
+        return (xcb_dizzy_run(&opts));
+    }
+#endif
+
+    if (use_threadsafe_api) {
+        if (!XInitThreads()) {
+            fprintf(stderr, "%s: XInitThreads() failure.\n", ProgramName);
             exit(EXIT_FAILURE);
         }
-        else {
-            swapInfo.swap_window = win;
+    }
+
+    windows = calloc(num_windows, sizeof(DizzyWindow));
+    if (windows == NULL) {
+        fprintf(stderr, "%s: Cannot allocate %d windows.\n",
+                ProgramName, num_windows);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < num_windows; i++) {
+        windows[i].index   = i;
+        windows[i].display = i % num_displays;
+        open_window(&windows[i], argc, argv);
+        if (stats_file != NULL &&
+            !frame_stats_init(&windows[i].stats, STATS_FRAMES, stats_sync)) {
+            fprintf(stderr, "%s: Cannot allocate %d frame statistics.\n",
+                    ProgramName, STATS_FRAMES);
+            exit(EXIT_FAILURE);
         }
     }
-    else {
-        buf = win; /* No double buffering. */
+    control.fd = -1;
+    if (control_path != NULL &&
+        !control_open(&control, control_path, control_command, &windows[0])) {
+        exit(EXIT_FAILURE);
     }
+    if (stats_file != NULL) {
+        struct sigaction sa;
 
-    /* Create GCs, one per color (to avoid pipeline flushing
-     * when the GC is changed) */
-    gcvals.line_width = 8L;
-    
-    gcvals.cap_style  = CapRound;
-#define CREATECOLORGC(cl) (gcvals.foreground = (cl), \
-                           XCreateGC(dpy, win, GCForeground | GCLineWidth | GCCapStyle, &gcvals))
-    gc_black  = CREATECOLORGC(c_black);
-    gc_pink   = CREATECOLORGC(c_pink);
-    gc_green  = CREATECOLORGC(c_green);
-    gc_orange = CREATECOLORGC(c_orange);
-    gc_blue   = CREATECOLORGC(c_blue);
-#undef CREATECOLORGC
-
-    XMapWindow(dpy, win);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = dump_signal;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, NULL);
+    }
 
-    main_loop();
+    if (num_windows == 1) {
+        window_thread(&windows[0]);
+        if (bench_frames > 0 || replay_path != NULL)
+            report_benchmark(&windows[0]);
+    }
+    else {
+        for (i = 0; i < num_windows; i++) {
+            if (pthread_create(&windows[i].thread, NULL, window_thread,
+                               &windows[i]) != 0) {
+                fprintf(stderr, "%s: Cannot create a thread for window %d.\n",
+                        ProgramName, i);
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (i = 0; i < num_windows; i++)
+            pthread_join(windows[i].thread, NULL);
+        report_windows();
+    }
 
-    XDestroyWindow(dpy, win);
-    XCloseDisplay(dpy);
+    if (stats_file != NULL)
+        dump_stats();
+    for (i = 0; i < num_windows; i++) {
+        frame_stats_free(&windows[i].stats);
+        close_window(&windows[i]);
+    }
+    control_close(&control);
+    trace_record_close();
+    trace_replay_close();
+    free(windows);
+    free(display_names);
+    scene_free(&scene);
     
     Log(("Done."));
 
     return EXIT_SUCCESS;
 }
-
-
@@ -0,0 +1,468 @@
+/*
+ * xdbedizzy - declarations shared between the xdbedizzy source files
+ *
+ * This file is distributed under the same terms as xdbedizzy.c.
+ */
+
+#ifndef XDBEDIZZY_H
+#define XDBEDIZZY_H 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/sync.h>
+
+#define Log(x) { if(verbose) printf x; }
+#define Msg(x) { printf x; }
+
+#define RATIO1 0.4
+#define RATIO2 0.7
+#define RATIO3 0.95
+
+#ifndef M_PI
+#define M_PI 3.1415927
+#endif
+
+#define S_ANGLE(s) (M_PI*2./(s))
+
+/* Width of all lines in the default scene */
+#define LINE_WIDTH 8
+
+/* How far the rings wobble around the window center */
+#define RING_WOBBLE 20
+
+/* Every color of the scene is drawn with its own GC; the first one is
+ * the background */
+#define COLOR_BACKGROUND 0
+#define MAX_COLORS       16
+
+/*
+ * Frame scheduler.  Frames are placed on a grid of absolute deadlines
+ * taken from CLOCK_MONOTONIC, so neither X events nor the time spent
+ * rendering shift the frame rate.
+ */
+typedef struct {
+    int64_t       period;   /* ns between two frames, 0 = unthrottled */
+    int64_t       next;     /* deadline of the next frame */
+    int64_t       last;     /* start of the previous frame, 0 = none */
+    Bool          catchup;  /* render missed frames instead of skipping */
+    unsigned long ticks;    /* frames started with frame_clock_tick() */
+    unsigned long frames;   /* frames rendered, counted by the caller */
+    unsigned long late;     /* frames started after their deadline */
+    unsigned long skipped;  /* deadlines dropped by the skip policy */
+} FrameClock;
+
+/*
+ * Per-frame timings collected by the benchmark mode.  All samples are
+ * preallocated so that recording does not disturb the measurement.
+ */
+typedef struct {
+    int      count;     /* samples recorded */
+    int      size;      /* samples allocated */
+    int64_t *total;     /* ns from start of frame to server completion */
+    int64_t *draw;      /* ns spent issuing the drawing requests */
+    int64_t *swap;      /* ns spent in XdbeSwapBuffers */
+    int64_t *wait;      /* ns waiting for the server to finish the frame */
+    int64_t  begin;     /* start of the first frame */
+    int64_t  end;       /* end of the last frame */
+} FrameTimes;
+
+/* Frames in flight limit, see lag.c */
+typedef struct {
+    Display      *dpy;
+    int           max;          /* frames allowed in flight, 0 = no limit */
+    Bool          use_sync;     /* counter and alarm, else XSync() */
+    int           event_base;   /* of the SYNC extension */
+    XSyncCounter  counter;
+    XSyncAlarm    alarm;
+    uint64_t      submitted;    /* frames marked */
+    uint64_t      completed;    /* last frame the server has processed */
+} FrameLag;
+
+/* Adaptive level of detail, see lod.c */
+typedef struct {
+    int64_t       period;       /* frame budget in ns, 0 = disabled */
+    int           level;        /* 0 = full detail */
+    double        avg;          /* smoothed frame cost in ns */
+    int           over, under;  /* consecutive frames above/below the thresholds */
+    unsigned long changes;      /* level changes so far */
+} LodGovernor;
+
+/*
+ * Input to swap latency probe of -latency, see latency.c.  One probe is
+ * in flight at a time: injected, then seen as a ButtonPress, then shown
+ * by a swap.
+ */
+typedef struct {
+    int      max;           /* probes to run */
+    int      count;         /* probes completed */
+    int64_t *input;         /* ns from injection to the ButtonPress */
+    int64_t *total;         /* ns from injection to the swap completed */
+    int64_t  injected;      /* time of the probe in flight, 0 = none */
+    int64_t  received;      /* time of its ButtonPress, 0 = not yet */
+    int64_t  next;          /* earliest time for the next probe */
+    int      button;        /* 1 or 2, alternating to keep |delta| */
+    int      lost;          /* probes that timed out */
+} LatencyProbe;
+
+/*
+ * Protocol statistics of one frame, see stats.c
+ */
+typedef struct {
+    unsigned long frame;        /* frame number */
+    int64_t       time;         /* start of the frame, ns since recording began */
+    int64_t       draw;         /* ns to build the frame and issue its requests */
+    int64_t       flush;        /* ns spent in XFlush() */
+    int64_t       sync;         /* ns for an XSync() round trip, -1 = not measured */
+    unsigned long requests;     /* X requests issued */
+    unsigned long draw_bytes;   /* estimated bytes of the drawing requests */
+} FrameStat;
+
+/* A ring of the last |size| FrameStat records; disabled if |ring| is NULL */
+typedef struct {
+    FrameStat       *ring;
+    int              size;
+    unsigned long    count;         /* frames recorded so far */
+    int              sync_interval; /* frames between XSync() probes, 0 = never */
+    int64_t          epoch;
+    pthread_mutex_t  lock;          /* taken by the writer and by dumps */
+    int64_t          t0;            /* of the frame being recorded */
+    unsigned long    request;
+    Bool             flushed;       /* frame_stats_flush() was called */
+    int64_t          t1, t2;        /* before and after its XFlush() */
+    unsigned long    requests;      /* issued up to its XFlush() */
+} FrameStats;
+
+enum {
+    STATS_CSV,
+    STATS_JSON
+};
+
+/*
+ * The primitives of one frame, grouped by color so that each GC can be
+ * sent with one poly request per frame.  |order| records the colors in
+ * the order they were first used, which is the order they are drawn in.
+ */
+typedef struct {
+    XArc     *arcs;
+    int       narcs, maxarcs;
+    XSegment *segs;
+    int       nsegs, maxsegs;
+} PrimBatch;
+
+typedef struct {
+    PrimBatch batch[MAX_COLORS];
+    int       order[MAX_COLORS];
+    int       norder;
+    int       line_width;   /* the primitives are stroked with */
+} DrawList;
+
+/*
+ * Spoke geometry of one frame in structure-of-arrays form: point k of
+ * spoke i is (x[k][i], y[k][i]); every spoke starts at (cx, cy).
+ */
+#define SPOKE_POINTS 3
+
+typedef struct {
+    int    spokes;                  /* spokes in the tables */
+    int    requested;               /* spokes asked for */
+    int    stride;                  /* every stride-th of them is kept */
+    int    capacity;                /* spokes allocated */
+    float *cos_base, *sin_base;     /* cos/sin of i * S_ANGLE(spokes) */
+    short *x[SPOKE_POINTS];
+    short *y[SPOKE_POINTS];
+    int    cx, cy;
+    double ratio[SPOKE_POINTS];     /* radius of each point, of (cx, cy) */
+    double lag[SPOKE_POINTS];       /* angle each point lags behind */
+    Bool   simd;                    /* use the SSE2 kernel if built in */
+    Bool   merge;                   /* merge spokes closer than a pixel */
+} SpokeGeometry;
+
+/*
+ * A scene as described by a -scene file, see scene.c: a palette and a
+ * list of layers of rings and spokes.
+ */
+enum {
+    LAYER_RINGS,
+    LAYER_SPOKES
+};
+
+typedef struct {
+    int    type;
+    int    color;                   /* index into the palette */
+    int    count;                   /* rings or spokes */
+    double radius, step;            /* rings: first radius, spacing in px */
+    double ratio[SPOKE_POINTS];     /* spokes: see SpokeGeometry */
+    double phase[SPOKE_POINTS];     /* spokes: lag of the points */
+    double speed;                   /* spokes: of the rotation */
+} SceneLayer;
+
+typedef struct {
+    char       *colors[MAX_COLORS]; /* color names, [0] is the background */
+    int         ncolors;
+    int         line_width;
+    SceneLayer *layers;
+    int         nlayers;
+} Scene;
+
+/*
+ * A Scene compiled for one window: the rings never change shape, so
+ * they are built once around (0, 0) and only translated every frame;
+ * every spoke layer has its own cached geometry.
+ */
+typedef struct {
+    const Scene   *scene;
+    DrawList       rings;
+    SpokeGeometry *spokes;          /* one per layer */
+} SceneLists;
+
+/*
+ * Settings handed to the backends that open their own connection and
+ * run their own main loop
+ */
+typedef struct {
+    const char *display_name;
+    int         visclass;
+    int         depth;
+    VisualID    visid;
+    Bool        do_db;
+    int         swap_action;
+    Bool        ring_cache;
+    Bool        cull;           /* drop invisible and sub-pixel primitives */
+    const Scene *scene;
+    double      delta;
+    double      fps;
+    Bool        catchup;
+    int         bench_frames;
+    int64_t     startup_begin;  /* dizzy_now_ns() at program start */
+} DizzyOptions;
+
+/*
+ * The file descriptors a main loop sleeps on, see evloop.c: the X
+ * connection, the control socket and its clients.  The frame deadline
+ * is a timerfd where the system has one.
+ */
+#define EVENT_LOOP_FDS 16
+
+typedef struct {
+    int     fds[EVENT_LOOP_FDS];
+    int     nfds;
+    int     epfd;           /* -1: select() */
+    int     timerfd;        /* -1: timeout of select() */
+    int64_t armed;          /* deadline the timerfd is set to, 0 = none */
+} EventLoop;
+
+/*
+ * Local control socket of -control, see control.c.  Every line a client
+ * sends is split into words and handed to |handler|, which writes the
+ * single line reply into |reply|.
+ */
+#define CONTROL_CLIENTS 8
+#define CONTROL_LINE    256
+
+typedef void (*ControlHandler)(void *data, int argc, char **argv,
+                               char *reply, size_t size);
+
+typedef struct {
+    int  fd;                        /* -1 = free */
+    int  len;                       /* bytes in |line| */
+    char line[CONTROL_LINE];
+} ControlClient;
+
+typedef struct {
+    int            fd;              /* listening socket, -1 = none */
+    const char    *path;
+    ControlClient  clients[CONTROL_CLIENTS];
+    ControlHandler handler;
+    void          *data;
+} ControlServer;
+
+/* xdbedizzy.c */
+extern char *ProgramName;
+extern Bool  verbose;
+
+/* affinity.c */
+extern int pin_thread(int n);
+
+/* bench.c */
+extern Bool frame_bench(FILE *fp, const char *scene_file, int frames,
+                        Bool cull);
+
+/* capture.c */
+extern Bool capture_open(Display *dpy, Window win, const char *path,
+                         int frames, double delta);
+extern Bool capture_frame(void);
+extern void capture_close(FILE *fp, const char *prefix);
+
+/* colors.c */
+extern Bool alloc_colors(Display *dpy, Visual *visual, Colormap cmap,
+                         char *const *names, int n, unsigned long *pixels);
+extern unsigned long true_color_pixel(unsigned long red_mask,
+                                      unsigned long green_mask,
+                                      unsigned long blue_mask,
+                                      const XColor *c);
+
+/* control.c */
+extern Bool control_open(ControlServer *cs, const char *path,
+                         ControlHandler handler, void *data);
+extern void control_close(ControlServer *cs);
+extern Bool control_handle(ControlServer *cs, EventLoop *el, int fd);
+
+/* drawlist.c */
+extern void draw_list_reset(DrawList *dl);
+extern void draw_list_free(DrawList *dl);
+extern void draw_list_add_arc(DrawList *dl, int color,
+                              int x, int y, int width, int height);
+extern void draw_list_add_polyline(DrawList *dl, int color,
+                                   const XPoint *pnt, int npoints);
+extern XArc *draw_list_reserve_arcs(DrawList *dl, int color, int narcs);
+extern XSegment *draw_list_reserve_segments(DrawList *dl, int color,
+                                            int nsegs);
+extern void draw_arcs(Display *dpy, Drawable d, GC gc, const XArc *arcs,
+                      int n);
+extern void draw_segments(Display *dpy, Drawable d, GC gc,
+                          const XSegment *segs, int n);
+extern void draw_list_emit(Display *dpy, Drawable d, GC *gcs,
+                           const DrawList *dl);
+extern unsigned long draw_list_request_bytes(Display *dpy,
+                                             const DrawList *dl);
+extern int  draw_list_cull_arcs(DrawList *dl, const XRectangle *view,
+                                int line_width);
+extern Bool draw_list_bounds(const DrawList *dl, int line_width,
+                             XRectangle *box);
+extern void rect_union(XRectangle *r, const XRectangle *a);
+extern Bool rect_intersect(XRectangle *r, const XRectangle *a);
+
+/* evloop.c */
+extern void event_loop_init(EventLoop *el);
+extern void event_loop_fini(EventLoop *el);
+extern Bool event_loop_watch(EventLoop *el, int fd);
+extern void event_loop_unwatch(EventLoop *el, int fd);
+extern int  event_loop_wait(EventLoop *el, int64_t deadline, int *ready,
+                            int max);
+
+/* geometry.c */
+extern void spoke_geometry_init(SpokeGeometry *g);
+extern void spoke_geometry_free(SpokeGeometry *g);
+extern void spoke_geometry_update(SpokeGeometry *g, int spokes,
+                                  double rotation, int cx, int cy);
+extern void spoke_geometry_emit(const SpokeGeometry *g, DrawList *dl,
+                                int color);
+extern void spoke_geometry_bench(FILE *fp, int spokes, int iterations);
+extern double spoke_rim(double ratio, int cx, int cy);
+extern int spoke_stride(int spokes, double rim, double gap);
+
+/* scene.c */
+extern void scene_default(Scene *s, int spokes);
+extern Bool scene_load(Scene *s, const char *path, int spokes);
+extern void scene_free(Scene *s);
+extern void scene_set_spokes(Scene *s, int spokes);
+extern void scene_lists_init(SceneLists *sl, const Scene *s, Bool merge);
+extern void scene_lists_free(SceneLists *sl);
+extern void scene_add_rings(DrawList *dl, const SceneLists *sl,
+                            int x, int y, int step);
+extern void scene_build_frame(DrawList *dl, SceneLists *sl,
+                              const LodGovernor *lod, double rotation,
+                              int width, int height,
+                              Bool with_rings, Bool cull);
+
+/* raster.c */
+extern Bool raster_init(Display *dpy, Visual *visual, int depth);
+extern void raster_fini(void);
+extern Bool raster_handle_event(const XEvent *ev);
+extern void raster_draw(const DrawList *dl, const unsigned long *pixels,
+                        unsigned long bg, int width, int height);
+extern void raster_present(Drawable d, GC gc);
+
+/* lag.c */
+extern void frame_lag_init(FrameLag *fl, Display *dpy, int max);
+extern void frame_lag_fini(FrameLag *fl);
+extern void frame_lag_mark(FrameLag *fl);
+extern Bool frame_lag_ready(const FrameLag *fl);
+extern Bool frame_lag_handle_event(FrameLag *fl, const XEvent *ev);
+
+/* latency.c */
+extern Bool latency_init(LatencyProbe *lp, Display *dpy, int probes);
+extern void latency_fini(LatencyProbe *lp);
+extern void latency_inject(LatencyProbe *lp, Display *dpy, Window win,
+                           int width, int height, int64_t now);
+extern Bool latency_input(LatencyProbe *lp, int64_t now);
+extern Bool latency_swapped(LatencyProbe *lp, Display *dpy);
+extern void latency_report(FILE *fp, const char *prefix,
+                           const LatencyProbe *lp);
+
+/* lod.c */
+extern void lod_init(LodGovernor *lod, int64_t period);
+extern Bool lod_update(LodGovernor *lod, int64_t cost);
+extern int  lod_spokes(const LodGovernor *lod, int spokes, double rim,
+                        int line_width);
+extern int  lod_ring_step(const LodGovernor *lod);
+extern Bool lod_skip_frame(const LodGovernor *lod, unsigned long frame);
+
+/* present.c */
+extern Bool   present_init(Display *dpy, Window win, int depth);
+extern void   present_fini(void);
+extern Bool   present_handle_event(XEvent *ev);
+extern Bool   present_ready(void);
+extern void   present_wait(int max);
+extern Pixmap present_next_pixmap(int width, int height);
+extern void   present_submit(void);
+extern void   present_report(FILE *fp);
+
+/* render.c */
+extern Bool   render_init(Display *dpy, Visual *visual, Colormap cmap,
+                          const unsigned long *pixels, int npixels);
+extern void   render_fini(void);
+extern void   render_forget(Drawable d);
+extern void   render_draw(Drawable d, const XRectangle *clip,
+                          const DrawList *dl);
+
+/* trace.c */
+extern Bool trace_record_open(const char *path, const Scene *scene);
+extern void trace_record_frame(const DrawList *dl, int width, int height,
+                               int64_t time);
+extern void trace_record_close(void);
+extern Bool trace_replay_open(const char *path, Scene *scene, int *frames,
+                              int *width, int *height);
+extern Bool trace_replay_next(int64_t *time, int *width, int *height);
+extern void trace_replay_emit(Display *dpy, Drawable d, GC *gcs);
+extern void trace_replay_close(void);
+
+/* viscache.c */
+extern Visual *visual_cache_lookup(Display *dpy, int screen, int visclass,
+                                   int depth, VisualID visid, int *pDepth);
+extern void    visual_cache_store(Display *dpy, int screen, int visclass,
+                                  int depth, VisualID visid,
+                                  const Visual *visual, int chosen);
+
+/* xcbdizzy.c */
+extern int xcb_dizzy_run(const DizzyOptions *opts);
+
+/* stats.c */
+extern Bool frame_stats_init(FrameStats *fs, int size, int sync_interval);
+extern void frame_stats_free(FrameStats *fs);
+extern void frame_stats_begin(FrameStats *fs, Display *dpy);
+extern void frame_stats_flush(FrameStats *fs, Display *dpy);
+extern void frame_stats_end(FrameStats *fs, Display *dpy, const DrawList *dl);
+extern Bool frame_stats_dump(const char *path, int format,
+                             FrameStats **stats, int n);
+
+/* timing.c */
+extern int64_t dizzy_now_ns(void);
+extern void    frame_clock_init(FrameClock *clk, double fps, Bool catchup);
+extern void    frame_clock_reset(FrameClock *clk);
+extern void    frame_clock_set_rate(FrameClock *clk, double fps);
+extern int64_t frame_clock_timeout(const FrameClock *clk, int64_t now);
+extern double  frame_clock_tick(FrameClock *clk, int64_t now);
+extern Bool    frame_times_init(FrameTimes *ft, int size);
+extern void    frame_times_free(FrameTimes *ft);
+extern void    frame_times_add(FrameTimes *ft, int64_t draw, int64_t swap,
+                               int64_t wait);
+extern void    frame_times_report(FILE *fp, const char *prefix,
+                                  const FrameTimes *ft);
+extern void    samples_sort(int64_t *v, int count);
+extern double  samples_percentile_ms(const int64_t *sorted, int count,
+                                     int pct);
+
+#endif /* !XDBEDIZZY_H */